@@ -1,8 +1,9 @@
 #ifndef MAPPER_H
 #define MAPPER_H
 
-#include <QDataStream>
+#include "../savestate.h"
 #include <QtGlobal>
+#include <cstring>
 
 // The function of Mapper is to map addresses from cartridge to CPU&PPU
 // There are mainly 4 ways of mapping：Horizontal、Vertical、OneScreen_Lo、OneScreen_Hi
@@ -11,7 +12,11 @@ enum MirrorMode { HORIZONTAL = 0, VERTICAL = 1, ONESCREEN_LO = 9, ONESCREEN_HI =
 class Mapper
 {
 public:
-    Mapper(quint8 rnum, quint8 vrnum) : rom_num(rnum), vrom_num(vrnum) {}
+    Mapper(quint16 rnum, quint16 vrnum)
+        : addram(nullptr), character_ram_ptr(nullptr), nametable_ram(nullptr), addram_size(0),
+          character_ram_size(0), rom_num(rnum), vrom_num(vrnum)
+    {
+    }
     virtual ~Mapper() {}
 
 public:
@@ -31,26 +36,37 @@ public:
     virtual quint32 ppu_write_pt(quint16 addr, quint8 data) = 0;
 
 public:
-    // IRQ Interface (for example, Mapper4 would use it)
-    virtual bool irqState() { return false; }
-    virtual void irqClear() {}
+    // IRQ line (for example, Mapper4 would use it). The mapper raises it when
+    // its counter fires and holds it until the game acknowledges; the CPU
+    // looks at it between instructions, so nothing polls the mapper.
+    bool irq_line = false;
 
     // Scanline Counting
     virtual void scanline() {}
 
 public:
-    // for save game
-    virtual void write_to_stream(QDataStream &) = 0;
-    // for load game
-    virtual void read_from_stream(QDataStream &) = 0;
+    // Save/load game. Mappers with registers override this and call the base version first.
+    virtual void serialize(StateIO &io)
+    {
+        io.pod(nametable_mirror);
+        // the pattern table and nametable RAM follow addram in the arena: one copy for all
+        io.block(addram, addram_size + character_ram_size + (nametable_ram ? nametable_ram_size : 0));
+    }
 
 public:
     quint8 nametable_mirror;
-    quint8 addram[0x2000]; // not every mapper has add ram, but still, it could be easiser this way
-    quint8 *character_ram_ptr; // if there is not pattern table on board, create a 8KB one
 
-    quint8 rom_num;  // PRG_Bank_num
-    quint8 vrom_num; // CHR_Bank_num
+    // Cartridge RAM, set up by Cartridge in the console's arena with the sizes
+    // the header asks for. Cartridge mirrors the offsets mappers return into it.
+    enum { nametable_ram_size = 0x800 };
+    quint8 *addram; // not every mapper has add ram, but still, it could be easiser this way
+    quint8 *character_ram_ptr; // if there is not pattern table on board, the CHR RAM, else nullptr
+    quint8 *nametable_ram;     // four-screen boards: the nametables at 0x2800-0x2FFF, else nullptr
+    quint32 addram_size;        // PRG RAM and NVRAM together, 0 if none
+    quint32 character_ram_size; // 0 if there is CHR ROM
+
+    quint16 rom_num;  // PRG_Bank_num
+    quint16 vrom_num; // CHR_Bank_num
 };
 
 #endif // MAPPER_H
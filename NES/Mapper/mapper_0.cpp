@@ -1,20 +1,8 @@
 #include "mapper_0.h"
 #include <QDebug>
 
-Mapper0::Mapper0(quint8 rnum, quint8 vrnum) : Mapper(rnum, vrnum)
+Mapper0::Mapper0(quint16 rnum, quint16 vrnum) : Mapper(rnum, vrnum)
 {
-    if (vrom_num == 0)
-        character_ram_ptr = new quint8[8192];
-    else
-        character_ram_ptr = nullptr;
-}
-
-Mapper0::~Mapper0()
-{
-    memset(addram, 0, 0x2000);
-    if (character_ram_ptr)
-        delete[] character_ram_ptr;
-    character_ram_ptr = NULL;
 }
 
 quint32 Mapper0::cpu_read_prg(quint16 addr)
@@ -30,17 +18,16 @@ quint32 Mapper0::cpu_write_prg(quint16 addr, quint8 data)
     return 0;
 }
 
+// Some NROM boards (Family BASIC, test ROMs like blargg's) have 8KB of RAM at 0x6000
 quint32 Mapper0::cpu_read_addram(quint16 addr)
 {
-    qDebug() << "Mapper0 doesn't have extra ram in" << QString::number(addr, 16);
-    return 0xFFFF;
+    return addr - 0x6000;
 }
 
 quint32 Mapper0::cpu_write_addram(quint16 addr, quint8 data)
 {
     Q_UNUSED(data);
-    qDebug() << "Mapper0 doesn't have extra ram in" << QString::number(addr, 16);
-    return 0xFFFF;
+    return addr - 0x6000;
 }
 
 quint32 Mapper0::ppu_read_pt(quint16 addr)
@@ -53,19 +40,3 @@ quint32 Mapper0::ppu_write_pt(quint16 addr, quint8 data)
     Q_UNUSED(data);
     return addr;
 }
-
-void Mapper0::write_to_stream(QDataStream &stream)
-{
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream << character_ram_ptr[i];
-    }
-}
-
-void Mapper0::read_from_stream(QDataStream &stream)
-{
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream >> character_ram_ptr[i];
-    }
-}
@@ -7,8 +7,7 @@
 class Mapper0 : public Mapper
 {
 public:
-    Mapper0(quint8 rom_num, quint8 vrom_num);
-    ~Mapper0();
+    Mapper0(quint16 rom_num, quint16 vrom_num);
 
     quint32 cpu_read_addram(quint16 addr) override;
     quint32 cpu_write_addram(quint16 addr, quint8 data) override;
@@ -17,9 +16,6 @@ public:
 
     quint32 ppu_read_pt(quint16 addr) override;
     quint32 ppu_write_pt(quint16 addr, quint8 data) override;
-
-    void write_to_stream(QDataStream &) override;
-    void read_from_stream(QDataStream &) override;
 };
 
 #endif // MAPPER_0_H
@@ -1,14 +1,8 @@
 #include "mapper_1.h"
 #include <QDebug>
 
-Mapper1::Mapper1(quint8 rnum, quint8 vrnum) : Mapper(rnum, vrnum)
+Mapper1::Mapper1(quint16 rnum, quint16 vrnum) : Mapper(rnum, vrnum)
 {
-    if (vrom_num == 0)
-        character_ram_ptr = new quint8[8192];
-    else
-        character_ram_ptr = nullptr;
-    memset(addram, 0, sizeof(quint8) * 0x2000);
-
     reg_ctrl.data = 0x1c;
     pt_select_4kb_lo = 0;
     pt_select_4kb_hi = 0;
@@ -19,14 +13,6 @@ Mapper1::Mapper1(quint8 rnum, quint8 vrnum) : Mapper(rnum, vrnum)
     prg_select_32kb = 0;
 }
 
-Mapper1::~Mapper1()
-{
-    memset(addram, 0, 0x2000);
-    if (character_ram_ptr)
-        delete[] character_ram_ptr;
-    character_ram_ptr = NULL;
-}
-
 quint32 Mapper1::cpu_read_addram(quint16 addr)
 {
     return addr - 0x6000;
@@ -157,52 +143,19 @@ quint32 Mapper1::ppu_write_pt(quint16 addr, quint8 data)
     return addr;
 }
 
-void Mapper1::write_to_stream(QDataStream &stream)
+void Mapper1::serialize(StateIO &io)
 {
-    stream << nametable_mirror;
-    for (int i = 0; i < 8192; i++) {
-        stream << addram[i];
-    }
-
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream << character_ram_ptr[i];
-    }
-
-    stream << num_write;
-    stream << reg_load;
-    stream << reg_ctrl.data;
-
-    stream << pt_select_4kb_lo;
-    stream << pt_select_4kb_hi;
-    stream << pt_select_8kb;
-
-    stream << prg_select_16kb_lo;
-    stream << prg_select_16kb_hi;
-    stream << prg_select_32kb;
-}
-
-void Mapper1::read_from_stream(QDataStream &stream)
-{
-    stream >> nametable_mirror;
-    for (int i = 0; i < 8192; i++) {
-        stream >> addram[i];
-    }
-
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream >> character_ram_ptr[i];
-    }
+    Mapper::serialize(io);
 
-    stream >> num_write;
-    stream >> reg_load;
-    stream >> reg_ctrl.data;
+    io.pod(num_write);
+    io.pod(reg_load);
+    io.pod(reg_ctrl.data);
 
-    stream >> pt_select_4kb_lo;
-    stream >> pt_select_4kb_hi;
-    stream >> pt_select_8kb;
+    io.pod(pt_select_4kb_lo);
+    io.pod(pt_select_4kb_hi);
+    io.pod(pt_select_8kb);
 
-    stream >> prg_select_16kb_lo;
-    stream >> prg_select_16kb_hi;
-    stream >> prg_select_32kb;
+    io.pod(prg_select_16kb_lo);
+    io.pod(prg_select_16kb_hi);
+    io.pod(prg_select_32kb);
 }
@@ -32,8 +32,7 @@ public:
 class Mapper1 : public Mapper
 {
 public:
-    Mapper1(quint8 rom_num, quint8 vrom_num);
-    ~Mapper1();
+    Mapper1(quint16 rom_num, quint16 vrom_num);
 
     quint32 cpu_read_addram(quint16 addr) override;
     quint32 cpu_write_addram(quint16 addr, quint8 data) override;
@@ -45,8 +44,7 @@ public:
 
 public:
     // For Save/Load Game
-    void write_to_stream(QDataStream &) override;
-    void read_from_stream(QDataStream &) override;
+    void serialize(StateIO &io) override;
 
 private:
     quint8 num_write = 0;
@@ -57,9 +55,10 @@ private:
     quint8 pt_select_4kb_hi;
     quint8 pt_select_8kb;
 
-    quint8 prg_select_16kb_lo;
-    quint8 prg_select_16kb_hi;
-    quint8 prg_select_32kb;
+    // PRG banks are as wide as rom_num: the fixed last bank can be past 255
+    quint16 prg_select_16kb_lo;
+    quint16 prg_select_16kb_hi;
+    quint16 prg_select_32kb;
 };
 
 #endif // MAPPER_1_H
@@ -1,24 +1,12 @@
 #include "mapper_2.h"
 #include <QDebug>
 
-Mapper2::Mapper2(quint8 rnum, quint8 vrnum) : Mapper(rnum, vrnum)
+Mapper2::Mapper2(quint16 rnum, quint16 vrnum) : Mapper(rnum, vrnum)
 {
-    if (vrom_num == 0)
-        character_ram_ptr = new quint8[8192];
-    else
-        character_ram_ptr = nullptr;
-
     prg_select_16kb_lo = 0;
     prg_select_16kb_hi = rom_num - 1;
 }
 
-Mapper2::~Mapper2()
-{
-    memset(addram, 0, 0x2000);
-    delete[] character_ram_ptr;
-    character_ram_ptr = NULL;
-}
-
 quint32 Mapper2::cpu_read_prg(quint16 addr)
 {
     // low 16KB
@@ -63,23 +51,10 @@ quint32 Mapper2::ppu_write_pt(quint16 addr, quint8 data)
     return addr;
 }
 
-void Mapper2::write_to_stream(QDataStream &stream)
+void Mapper2::serialize(StateIO &io)
 {
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream << character_ram_ptr[i];
-    }
+    Mapper::serialize(io);
 
-    stream << prg_select_16kb_lo;
-    stream << prg_select_16kb_hi;
-}
-
-void Mapper2::read_from_stream(QDataStream &stream)
-{
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream >> character_ram_ptr[i];
-    }
-    stream >> prg_select_16kb_lo;
-    stream >> prg_select_16kb_hi;
+    io.pod(prg_select_16kb_lo);
+    io.pod(prg_select_16kb_hi);
 }
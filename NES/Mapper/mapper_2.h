@@ -8,8 +8,7 @@
 class Mapper2 : public Mapper
 {
 public:
-    Mapper2(quint8 rom_num, quint8 vrom_num);
-    ~Mapper2();
+    Mapper2(quint16 rom_num, quint16 vrom_num);
 
     quint32 cpu_read_addram(quint16 addr) override;
     quint32 cpu_write_addram(quint16 addr, quint8 data) override;
@@ -21,12 +20,11 @@ public:
 
 public:
     // For Save/Load game
-    void write_to_stream(QDataStream &) override;
-    void read_from_stream(QDataStream &) override;
+    void serialize(StateIO &io) override;
 
 private:
-    quint8 prg_select_16kb_lo;
-    quint8 prg_select_16kb_hi;
+    quint16 prg_select_16kb_lo;
+    quint16 prg_select_16kb_hi; // the last bank, as wide as rom_num
 };
 
 #endif // MAPPER_2_H
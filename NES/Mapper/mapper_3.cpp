@@ -1,24 +1,11 @@
 #include "mapper_3.h"
 #include <QDebug>
 
-Mapper3::Mapper3(quint8 rnum, quint8 vrnum) : Mapper(rnum, vrnum)
+Mapper3::Mapper3(quint16 rnum, quint16 vrnum) : Mapper(rnum, vrnum)
 {
-    if (vrom_num == 0)
-        character_ram_ptr = new quint8[8192];
-    else
-        character_ram_ptr = nullptr;
-
     nCHRBankSelect = 0;
 }
 
-Mapper3::~Mapper3()
-{
-    memset(addram, 0, sizeof(quint8) * 0x2000);
-    if (character_ram_ptr)
-        delete[] character_ram_ptr;
-    character_ram_ptr = NULL;
-}
-
 quint32 Mapper3::cpu_read_prg(quint16 addr)
 {
     quint32 prg_addr = addr & (rom_num > 1 ? 0x7fff : 0x3fff);
@@ -60,21 +47,9 @@ quint32 Mapper3::ppu_write_pt(quint16 addr, quint8 data)
     return addr;
 }
 
-void Mapper3::write_to_stream(QDataStream &stream)
+void Mapper3::serialize(StateIO &io)
 {
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream << character_ram_ptr[i];
-    }
+    Mapper::serialize(io);
 
-    stream << nCHRBankSelect;
-}
-
-void Mapper3::read_from_stream(QDataStream &stream)
-{
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream >> character_ram_ptr[i];
-    }
-    stream >> nCHRBankSelect;
+    io.pod(nCHRBankSelect);
 }
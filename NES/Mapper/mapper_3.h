@@ -9,8 +9,7 @@
 class Mapper3 : public Mapper
 {
 public:
-    Mapper3(quint8 rom_num, quint8 vrom_num);
-    ~Mapper3();
+    Mapper3(quint16 rom_num, quint16 vrom_num);
 
     quint32 cpu_read_addram(quint16 addr) override;
     quint32 cpu_write_addram(quint16 addr, quint8 data) override;
@@ -22,8 +21,7 @@ public:
 
 public:
     // For Save/Load game
-    void write_to_stream(QDataStream &) override;
-    void read_from_stream(QDataStream &) override;
+    void serialize(StateIO &io) override;
 
 private:
     quint8 nCHRBankSelect;
@@ -1,20 +1,13 @@
 #include "mapper_4.h"
 #include <QDebug>
 
-Mapper4::Mapper4(quint8 rnum, quint8 vrnum) : Mapper(rnum, vrnum)
+Mapper4::Mapper4(quint16 rnum, quint16 vrnum) : Mapper(rnum, vrnum)
 {
-    if (vrom_num == 0)
-        character_ram_ptr = new quint8[8192];
-    else
-        character_ram_ptr = nullptr;
-
-    memset(addram, 0, sizeof(quint8) * 0x2000);
-
     nTargetRegister = 0x00;
     bPRGBankMode = false;
     bCHRInversion = false;
 
-    bIRQActive = false;
+    irq_line = false;
     bIRQEnable = false;
     bIRQUpdate = false;
     nIRQCounter = 0x00;
@@ -32,14 +25,6 @@ Mapper4::Mapper4(quint8 rnum, quint8 vrnum) : Mapper(rnum, vrnum)
     pPRGBank[3] = (rom_num * 2 - 1) * 0x2000;
 }
 
-Mapper4::~Mapper4()
-{
-    memset(addram, 0, sizeof(quint8) * 0x2000);
-    if (character_ram_ptr)
-        delete[] character_ram_ptr;
-    character_ram_ptr = NULL;
-}
-
 quint32 Mapper4::cpu_read_addram(quint16 addr)
 {
     return (quint32)(addr & 0x1FFF);
@@ -140,7 +125,7 @@ quint32 Mapper4::cpu_write_prg(quint16 addr, quint8 data)
     if (addr >= 0xE000 && addr <= 0xFFFF) {
         if (!(addr & 0x0001)) {
             bIRQEnable = false;
-            bIRQActive = false;
+            irq_line = false;
         } else {
             bIRQEnable = true;
         }
@@ -184,16 +169,6 @@ quint32 Mapper4::ppu_write_pt(quint16 addr, quint8 data)
     return addr;
 }
 
-bool Mapper4::irqState()
-{
-    return bIRQActive;
-}
-
-void Mapper4::irqClear()
-{
-    bIRQActive = false;
-}
-
 void Mapper4::scanline()
 {
     if (nIRQCounter == 0) {
@@ -202,70 +177,26 @@ void Mapper4::scanline()
         nIRQCounter--;
 
     if (nIRQCounter == 0 && bIRQEnable) {
-        bIRQActive = true;
-    }
-}
-
-void Mapper4::write_to_stream(QDataStream &stream)
-{
-    stream << nametable_mirror;
-
-    for (int i = 0; i < 8192; i++)
-        stream << addram[i];
-
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream << character_ram_ptr[i];
-    }
-
-    stream << nTargetRegister;
-    stream << bPRGBankMode;
-    stream << bCHRInversion;
-
-    for (int i = 0; i < 8; i++) {
-        stream << pRegister[i];
-        stream << pCHRBank[i];
+        irq_line = true;
     }
-
-    for (int i = 0; i < 4; i++)
-        stream << pPRGBank[i];
-
-    stream << bIRQActive;
-    stream << bIRQEnable;
-    stream << bIRQUpdate;
-
-    stream << nIRQCounter;
-    stream << nIRQReload;
 }
 
-void Mapper4::read_from_stream(QDataStream &stream)
+void Mapper4::serialize(StateIO &io)
 {
-    stream >> nametable_mirror;
-
-    for (int i = 0; i < 8192; i++)
-        stream >> addram[i];
+    Mapper::serialize(io);
 
-    if (vrom_num == 0) {
-        for (int i = 0; i < 8192; i++)
-            stream >> character_ram_ptr[i];
-    }
-
-    stream >> nTargetRegister;
-    stream >> bPRGBankMode;
-    stream >> bCHRInversion;
-
-    for (int i = 0; i < 8; i++) {
-        stream >> pRegister[i];
-        stream >> pCHRBank[i];
-    }
+    io.pod(nTargetRegister);
+    io.pod(bPRGBankMode);
+    io.pod(bCHRInversion);
 
-    for (int i = 0; i < 4; i++)
-        stream >> pPRGBank[i];
+    io.block(pRegister, sizeof(pRegister));
+    io.block(pCHRBank, sizeof(pCHRBank));
+    io.block(pPRGBank, sizeof(pPRGBank));
 
-    stream >> bIRQActive;
-    stream >> bIRQEnable;
-    stream >> bIRQUpdate;
+    io.pod(irq_line);
+    io.pod(bIRQEnable);
+    io.pod(bIRQUpdate);
 
-    stream >> nIRQCounter;
-    stream >> nIRQReload;
+    io.pod(nIRQCounter);
+    io.pod(nIRQReload);
 }
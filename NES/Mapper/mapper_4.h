@@ -6,8 +6,7 @@
 class Mapper4 : public Mapper
 {
 public:
-    Mapper4(quint8, quint8);
-    ~Mapper4();
+    Mapper4(quint16, quint16);
 
     quint32 cpu_read_addram(quint16 addr) override;
     quint32 cpu_write_addram(quint16 addr, quint8 data) override;
@@ -20,14 +19,10 @@ public:
     quint32 ppu_read_pt(quint16 addr) override;
     quint32 ppu_write_pt(quint16 addr, quint8 data) override;
 
-    bool irqState() override;
-    void irqClear() override;
-
     void scanline() override;
 
 public:
-    void write_to_stream(QDataStream &) override;
-    void read_from_stream(QDataStream &) override;
+    void serialize(StateIO &io) override;
 
 private:
     // Data: 0b 1   1 ---   111
@@ -50,7 +45,6 @@ private:
     // C000-FFFF would always point to the last 2 banks
     quint32 pPRGBank[4];
 
-    bool bIRQActive;
     bool bIRQEnable;
     bool bIRQUpdate;
 
@@ -6,8 +6,7 @@
 class Mapper66 : public Mapper
 {
 public:
-    Mapper66(quint8 rom_num, quint8 vrom_num);
-    ~Mapper66();
+    Mapper66(quint16 rom_num, quint16 vrom_num);
 
     quint32 cpu_read_addram(quint16 addr) override;
     quint32 cpu_write_addram(quint16 addr, quint8 data) override;
@@ -19,8 +18,7 @@ public:
 
 public:
     // For Save/Load game
-    void write_to_stream(QDataStream &) override;
-    void read_from_stream(QDataStream &) override;
+    void serialize(StateIO &io) override;
 
 private:
     quint8 nCHRBankSelect;
@@ -1,6 +1,7 @@
 // Nes_Snd_Emu 0.1.7. http://www.slack.net/~ant/libs/
 
 #include "Simple_Apu.h"
+#include "savestate.h"
 #include <cstring>
 
 /* Copyright (C) 2003-2005 Shay Green. This module is free software; you
@@ -19,13 +20,17 @@ static int null_dmc_reader(void*, cpu_addr_t)
 	return 0x55; // causes dmc sample to be flat
 }
 
+static const quint64 no_irq_time = ~(quint64) 0;
+
 Simple_Apu::Simple_Apu()
 {
     memset(out_buf, 0, sizeof(blip_sample_t) * BUFFER_SIZE);
     out_count = 0;
-    time = 0;
-    frame_length = 29780;
+    frame_start = 0;
+    next_irq = no_irq_time;
+    suppressed = false;
     apu.dmc_reader(null_dmc_reader, NULL);
+    apu.irq_notifier(irq_changed, this);
     if (sample_rate(44100))
         abort();
 }
@@ -38,12 +43,21 @@ void Simple_Apu::reset()
 {
     memset(out_buf, 0, sizeof(blip_sample_t) * BUFFER_SIZE);
     out_count = 0;
-    time = 0;
-    frame_length = 29780;
+    frame_start = 0;
     apu.reset();
     buf.clear();
     if (sample_rate(44100))
         abort();
+    update_irq();
+}
+
+void Simple_Apu::soft_reset(quint64 cpu_time)
+{
+    apu_snapshot_t state;
+    apu.run_until(frame_time(cpu_time));
+    apu.save_snapshot(&state);
+    write_register(cpu_time, 0x4015, 0x00);
+    write_register(cpu_time, 0x4017, state.w4017);
 }
 
 void Simple_Apu::dmc_reader(int (*f)(void* user_data, cpu_addr_t), void* p)
@@ -54,27 +68,54 @@ void Simple_Apu::dmc_reader(int (*f)(void* user_data, cpu_addr_t), void* p)
 
 blargg_err_t Simple_Apu::sample_rate(long rate)
 {
-	apu.output(&buf);
+	apu.output(suppressed ? &scratch : &buf);
 	buf.clock_rate(1789773);
+	scratch.clock_rate(1789773);
+	blargg_err_t err = scratch.sample_rate(rate, 100);
+	if (err)
+		return err;
 	return buf.sample_rate(rate);
 }
 
-void Simple_Apu::write_register(cpu_addr_t addr, int data)
+void Simple_Apu::write_register(quint64 cpu_time, cpu_addr_t addr, int data)
+{
+    apu.write_register(frame_time(cpu_time), addr, data);
+}
+
+int Simple_Apu::read_status(quint64 cpu_time)
+{
+    return apu.read_status(frame_time(cpu_time));
+}
+
+void Simple_Apu::end_frame(quint64 cpu_time)
 {
-    apu.write_register(clock(), addr, data);
+    blip_time_t length = frame_time(cpu_time);
+    apu.end_frame(length);
+    if (suppressed) {
+        scratch.end_frame(length);
+        scratch.remove_samples(scratch.samples_avail());
+    } else {
+        buf.end_frame(length);
+    }
+    frame_start = cpu_time;
+    update_irq(); // earliest_irq() is now relative to the new frame
 }
 
-int Simple_Apu::read_status()
+void Simple_Apu::suppress_output(bool suppress)
 {
-    return apu.read_status(clock());
+    suppressed = suppress;
+    apu.output(suppressed ? &scratch : &buf);
 }
 
-void Simple_Apu::end_frame()
+void Simple_Apu::update_irq()
 {
-    time = 0;
-    frame_length ^= 1;
-    apu.end_frame(frame_length);
-    buf.end_frame(frame_length);
+    cpu_time_t t = apu.earliest_irq();
+    next_irq = (t == Nes_Apu::no_irq) ? no_irq_time : frame_start + t;
+}
+
+void Simple_Apu::irq_changed(void *user_data)
+{
+    static_cast<Simple_Apu *>(user_data)->update_irq();
 }
 
 long Simple_Apu::samples_avail() const
@@ -97,21 +138,21 @@ void Simple_Apu::load_snapshot(apu_snapshot_t const& in)
 	apu.load_snapshot(in);
 }
 
-QDataStream &operator<<(QDataStream &stream, const Simple_Apu &Apu)
+void Simple_Apu::serialize(StateIO &io, quint64 cpu_time)
 {
-    stream << (quint64) Apu.time;
-    stream << (quint64) Apu.frame_length;
-    return stream;
-}
-
-QDataStream &operator>>(QDataStream &stream, Simple_Apu &Apu)
-{
-    quint64 time, frame_length;
-    stream >> time;
-    Apu.time = time;
-
-    stream >> frame_length;
-    Apu.frame_length = frame_length;
-
-    return stream;
+    apu_snapshot_t state;
+    io.begin_chunk(STATE_TAG('A', 'P', 'U', ' '));
+    if (!io.is_loading()) {
+        apu.run_until(frame_time(cpu_time)); // snapshot is relative to the time the APU has run to
+        apu.save_snapshot(&state);
+        io.pod(state);
+    } else {
+        io.pod(state);
+        if (io.ok()) {
+            frame_start = cpu_time;
+            apu.load_snapshot(state);
+            update_irq();
+        }
+    }
+    io.end_chunk();
 }
@@ -7,20 +7,25 @@
 
 #include "nes_apu/Blip_Buffer.h"
 #include "nes_apu/Nes_Apu.h"
-#include <QDataStream>
+#include "nes_apu/apu_snapshot.h"
+#include <QtGlobal>
 
 #define BUFFER_SIZE 2048
 
+class StateIO;
+
 class Simple_Apu
 {
-    friend QDataStream &operator<<(QDataStream &stream, const Simple_Apu &Apu); // 序列化
-    friend QDataStream &operator>>(QDataStream &stream, Simple_Apu &Apu);       // 反序列化
 public:
 	Simple_Apu();
     ~Simple_Apu();
 
     void reset(); // 读取新卡带后，重置
 
+    // The reset button: channels silenced ($4015 = 0) and the frame counter
+    // restarted as if its mode were written to $4017 again
+    void soft_reset(quint64 cpu_time);
+
     // This simpler interface works well for most games. Some benefit from
 	// the higher precision of the full Nes_Apu interface, which provides
 	// clock-cycle accurate register read/write and IRQ timing functions.
@@ -31,11 +36,17 @@ public:
     // Set output sample rate
     blargg_err_t sample_rate(long rate);
 
+    // All times are absolute CPU cycle counts, as kept by the Bus. The APU
+    // only runs when a register is accessed or a frame ends.
+
     // Write to register (0x4000-0x4017, except 0x4014 and 0x4016)
-    void write_register(cpu_addr_t, int data);
+    void write_register(quint64 cpu_time, cpu_addr_t, int data);
 
     // Read from status register at 0x4015
-    int read_status();
+    int read_status(quint64 cpu_time);
+
+    // True if the APU is asserting IRQ at the given time
+    bool irq_pending(quint64 cpu_time) const { return cpu_time >= next_irq; }
 
     // Number of samples in buffer
     long samples_avail() const;
@@ -48,8 +59,17 @@ public:
 	void save_snapshot(apu_snapshot_t* out) const;
 	void load_snapshot(apu_snapshot_t const&);
 
-    // End a 1/60 sound frame
-    void end_frame();
+    // Save/load full APU state at given time. Loading keeps the sound
+    // buffered so far, so states should be taken between frames.
+    void serialize(StateIO &io, quint64 cpu_time);
+
+    // Send sound to a scratch buffer that is thrown away at end of frame.
+    // The APU still runs exactly as usual (e.g. for run-ahead frames).
+    void suppress_output(bool suppress);
+    bool output_suppressed() const { return suppressed; }
+
+    // End sound frame at given time and make its samples available
+    void end_frame(quint64 cpu_time);
 
 public:
     blip_sample_t out_buf[BUFFER_SIZE];
@@ -58,9 +78,13 @@ public:
 private:
 	Nes_Apu apu;
 	Blip_Buffer buf;
-    blip_time_t time;
-    blip_time_t frame_length;
-    blip_time_t clock() { return time += 4; }
+	Blip_Buffer scratch; // output while suppressed
+	bool suppressed;
+    quint64 frame_start; // CPU time at which current sound frame began
+    quint64 next_irq;    // CPU time of earliest APU IRQ, or never
+    blip_time_t frame_time(quint64 cpu_time) const { return blip_time_t(cpu_time - frame_start); }
+    void update_irq();
+    static void irq_changed(void *user_data);
 };
 
 #endif
@@ -1,12 +1,21 @@
 #include "bus.h"
+#include "savestate.h"
 #include <QDebug>
-#include <QMessageBox>
+#include <climits>
+
+static int read_dmc(void *user_data, cpu_addr_t addr)
+{
+    return static_cast<Bus *>(user_data)->load(addr);
+}
 
 Bus::Bus()
 {
     clock_count = 0;
+    cpu_cycles = 0;
+    frames = 0;
     this->Cpu.connectToBus(this);
     Ppu.ConnectCartridge(&cartridge);
+    Apu.dmc_reader(read_dmc, this);
     controller_left.init();
     controller_right.init();
     SetKeyMap();
@@ -16,19 +25,59 @@ void Bus::reset()
 {
     memset(ram_data, 0, sizeof(quint8) * 2048);
     clock_count = 0;
+    cpu_cycles = 0;
+    frames = 0;
+    dma_page = 0x00;
+    dma_addr = 0x00;
+    dma_data = 0x00;
+    dma_dummy = true;
+    dma_transfer = false;
+    dma_stall = 0;
+    controller_left.init();
+    controller_right.init();
     Cpu.reset();
     Ppu.reset();
     Apu.reset();
 }
 
+// Runs that must start the same every time (movies, training episodes) come
+// through here, so nothing is left from what ran before
+void Bus::power_on()
+{
+    cartridge.power_on();
+    reset();
+}
+
+// What the console's reset line reaches: the CPU runs its reset sequence,
+// the PPU clears its registers and the APU goes quiet
+void Bus::soft_reset()
+{
+    dma_transfer = false;
+    dma_dummy = true;
+    dma_stall = 0;
+    Cpu.soft_reset();
+    Ppu.soft_reset();
+    Apu.soft_reset(cpu_cycles);
+}
+
 void Bus::clock()
 {
     Ppu.clock();
 
     if (clock_count % 3 == 0) {
-        if (dma_transfer) {
-            // wait for clock sync
-            if (dma_dummy) {
+        if (dma_stall) {
+            if (--dma_stall == 0) {
+                // where the byte by byte copy would have ended
+                dma_data = Ppu.pOAM[255];
+                dma_addr = 0x00;
+                dma_transfer = false;
+                dma_dummy = true;
+            }
+        } else if (dma_transfer) {
+            if (dma_dummy && dma_addr == 0x00 && start_fast_dma()) {
+                // this cycle was the first of the stall
+            } else if (dma_dummy) {
+                // wait for clock sync
                 if (clock_count % 2 == 1) {
                     dma_dummy = false;
                 }
@@ -50,28 +99,81 @@ void Bus::clock()
             }
         } else {
             clock_count %= 0x3FFFFFFF; // avoid out of bound(2^31-1)
+
+            // Interrupts are taken between instructions: NMI once for each edge
+            // the PPU latched, IRQ for as long as the APU or the mapper holds
+            // its line and the CPU lets it in
+            if (Cpu.cycles_wait == 0 && !Cpu.jammed) {
+                if (Ppu.nmi) {
+                    Ppu.nmi = false;
+                    Cpu.nmi();
+                } else if (Apu.irq_pending(cpu_cycles) || cartridge.mapper_ptr->irq_line) {
+                    Cpu.irq();
+                }
+            }
             Cpu.clock();
         }
+        cpu_cycles++;
     }
 
-    if (Ppu.nmi) {
-        Ppu.nmi = false;
-        Cpu.nmi();
-    }
+    clock_count++;
+}
 
-    if (cartridge.mapper_ptr->irqState()) {
-        cartridge.mapper_ptr->irqClear();
-        Cpu.irq();
-    }
+void Bus::run_frame()
+{
+    do {
+        clock();
+    } while (!Ppu.frame_complete);
+    end_frame();
+}
 
-    clock_count++;
+void Bus::end_frame()
+{
+    Ppu.frame_complete = false;
+    frames++;
+
+    Apu.end_frame(cpu_cycles);
 }
 
-void Bus::save(quint16 addr, quint8 data)
+// Pages without read side effects (RAM, cartridge RAM and ROM) while the
+// PPU is in vertical blank with time to spare: the stall ends by scanline
+// 260 at the latest, before the pre-render line evaluates sprites again
+bool Bus::start_fast_dma()
 {
-    if (addr < 0x2000) {
-        ram_data[addr & 0x7ff] = data;
-    } else if (addr < 0x4000) {
+    int scanline = Ppu.get_scanline();
+    if ((dma_page >= 0x20 && dma_page < 0x60) || scanline < 240 || scanline > 255)
+        return false;
+
+    quint16 base = quint16(dma_page << 8);
+    for (int i = 0; i < 256; i++)
+        Ppu.pOAM[i] = load(base + i);
+
+    // one or two cycles to get in step, then a read and a write per byte
+    int cycles = (clock_count % 2 == 1 ? 1 : 2) + 512;
+    dma_stall = cycles - 1;
+    return true;
+}
+
+// The fields the byte by byte copy would have at this point of a fast DMA,
+// so a state saved in the middle of one resumes on that path
+void Bus::sync_dma_fields()
+{
+    if (dma_stall > 512) {
+        // still getting in step
+        return;
+    }
+    int done = 512 - dma_stall;
+    dma_dummy = false;
+    dma_addr = quint8(done / 2);
+    if (done % 2)
+        dma_data = Ppu.pOAM[dma_addr];
+    else if (done)
+        dma_data = Ppu.pOAM[dma_addr - 1];
+}
+
+void Bus::save_io(quint16 addr, quint8 data)
+{
+    if (addr < 0x4000) {
         switch (addr & 0x2007) {
         case 0x2000: // PPU ctrl
             Ppu.write_ctrl(data);
@@ -99,8 +201,8 @@ void Bus::save(quint16 addr, quint8 data)
             break;
         }
     } else if ((addr >= 0x4000 && addr <= 0x4013) || addr == 0x4015 || addr == 0x4017) {
-        // APU write
-        Apu.write_register(addr, data);
+        // APU write, on the instruction's write cycle
+        Apu.write_register(cpu_cycles + Cpu.access_delay(), addr, data);
     } else if (addr == 0x4014) {
         // OAM DMA
         dma_page = data;
@@ -119,11 +221,18 @@ void Bus::save(quint16 addr, quint8 data)
     }
 }
 
-quint8 Bus::load(quint16 addr)
+quint8 Bus::peek(quint16 addr)
 {
-    if (addr < 0x2000) {
+    if (addr < 0x2000)
         return ram_data[addr & 0x7ff];
-    } else if (addr < 0x4000) {
+    if (addr >= 0x6000)
+        return cartridge.CpuRead(addr);
+    return 0;
+}
+
+quint8 Bus::load_io(quint16 addr)
+{
+    if (addr < 0x4000) {
         switch (addr & 0x2007) {
         case 0x2000: // PPU ctrl
             qDebug("cannot read PPU CTRL\n");
@@ -131,8 +240,8 @@ quint8 Bus::load(quint16 addr)
         case 0x2001: // PPU mask
             qDebug("cannot read PPU MASK\n");
             break;
-        case 0x2002: // PPU status
-            return Ppu.get_status();
+        case 0x2002: // PPU status, as the CPU's read cycle will find it
+            return Ppu.get_status(dma_transfer ? 0 : 3 * Cpu.access_delay());
         case 0x2003:
             qDebug("cannot read OAMADDR\n");
             break;
@@ -148,8 +257,8 @@ quint8 Bus::load(quint16 addr)
             return Ppu.read_data();
         }
     } else if (addr == 0x4015) {
-        // APU Status
-        return Apu.read_status();
+        // APU Status, on the instruction's read cycle
+        return Apu.read_status(cpu_cycles + Cpu.access_delay());
     } else if (addr == 0x4016) {
         // controller 1 key state
         return controller_left.output_key_states();
@@ -158,9 +267,7 @@ quint8 Bus::load(quint16 addr)
         return controller_right.output_key_states();
     } else if (addr >= 0x4000 && addr < 0x6000) {
         qDebug() << "0x4000 - 0x6000, Cannot read " << QString::number(addr, 16);
-    } else if (addr >= 0x6000 && addr < 0x8000) {
-        return cartridge.CpuRead(addr);
-    } else {
+    } else if (addr >= 0x6000) {
         return cartridge.CpuRead(addr);
     }
     return 0;
@@ -189,51 +296,102 @@ void Bus::SetKeyMap()
     this->controller_right.key_map.insert(Qt::Key_BracketRight, FC_KEY_SELECT);
 }
 
-QDataStream &operator<<(QDataStream &stream, const Bus &bus)
+void Bus::save_state(QByteArray &out)
+{
+    StateIO io(out);
+    QByteArray md5 = cartridge.md5_val;
+    io.begin_chunk(STATE_TAG('I', 'N', 'F', 'O'));
+    io.block(md5.data(), md5.size());
+    io.end_chunk();
+    serialize(io);
+}
+
+quint64 Bus::state_hash()
+{
+    StateIO io(hash_buffer);
+    serialize(io);
+    return hash_state(hash_buffer.constData(), hash_buffer.size());
+}
+
+int Bus::snapshot_size()
 {
-    stream << bus.cartridge.md5_val;
-    stream << bus.Cpu;
-    stream << bus.Ppu;
-    stream << bus.Apu;
-    bus.cartridge.mapper_ptr->write_to_stream(stream);
+    StateIO io = StateIO::raw_writer(nullptr, INT_MAX);
+    serialize(io);
+    return io.size();
+}
 
-    for (int i = 0; i < 2048; i++)
-        stream << bus.ram_data[i];
+void Bus::clone(char *out)
+{
+    StateIO io = StateIO::raw_writer(out, INT_MAX);
+    serialize(io);
+}
 
-    stream << bus.clock_count;
-    stream << bus.dma_page;
-    stream << bus.dma_addr;
-    stream << bus.dma_data;
-    stream << bus.dma_dummy;
-    stream << bus.dma_transfer;
-    return stream;
+void Bus::restore_from(const char *in)
+{
+    StateIO io = StateIO::raw_reader(in, INT_MAX);
+    serialize(io);
 }
 
-QDataStream &operator>>(QDataStream &stream, Bus &bus)
+bool Bus::load_state(const QByteArray &in)
 {
-    QByteArray md5_tmp;
-    stream >> md5_tmp;
+    StateIO io(in.constData(), in.size());
+
+    // check game before touching anything
+    QByteArray md5 = cartridge.md5_val;
+    io.begin_chunk(STATE_TAG('I', 'N', 'F', 'O'));
+    io.block(md5.data(), md5.size());
+    io.end_chunk();
+    if (!io.ok() || md5 != cartridge.md5_val) {
+        qDebug() << "Savestate doesn't match current game";
+        return false;
+    }
 
-    if (md5_tmp != bus.cartridge.md5_val) {
-        QMessageBox::critical(nullptr,
-                              QStringLiteral("ERROR"),
-                              QStringLiteral("Savefile isn't compatible with current game!"));
-        return stream;
+    // A damaged chunk only shows once serialize() has reached it, with the
+    // chunks before it already loaded, so keep a copy to go back to
+    load_backup.resize(snapshot_size());
+    clone(load_backup.data());
+    serialize(io);
+    if (!io.ok()) {
+        restore_from(load_backup.constData());
+        qDebug() << "Savestate is damaged";
+        return false;
     }
+    return true;
+}
+
+void Bus::serialize(StateIO &io)
+{
+    if (dma_stall) {
+        if (io.is_loading())
+            dma_stall = 0;
+        else
+            sync_dma_fields();
+    }
+
+    io.begin_chunk(STATE_TAG('B', 'U', 'S', ' '));
+    io.block(ram_data, sizeof(ram_data));
+    io.pod(clock_count);
+    io.pod(cpu_cycles);
+    io.pod(frames);
+    io.pod(dma_page);
+    io.pod(dma_addr);
+    io.pod(dma_data);
+    io.pod(dma_dummy);
+    io.pod(dma_transfer);
+    io.end_chunk();
+
+    Cpu.serialize(io);
+    Ppu.serialize(io);
+    Apu.serialize(io, cpu_cycles);
+
+    io.begin_chunk(STATE_TAG('M', 'A', 'P', 'R'));
+    cartridge.mapper_ptr->serialize(io);
+    io.end_chunk();
+    if (io.is_loading())
+        cartridge.forget_prg_windows(); // banks may have changed
 
-    stream >> bus.Cpu;
-    stream >> bus.Ppu;
-    stream >> bus.Apu;
-    bus.cartridge.mapper_ptr->read_from_stream(stream);
-
-    for (int i = 0; i < 2048; i++)
-        stream >> bus.ram_data[i];
-
-    stream >> bus.clock_count;
-    stream >> bus.dma_page;
-    stream >> bus.dma_addr;
-    stream >> bus.dma_data;
-    stream >> bus.dma_dummy;
-    stream >> bus.dma_transfer;
-    return stream;
+    io.begin_chunk(STATE_TAG('C', 'T', 'R', 'L'));
+    controller_left.serialize(io);
+    controller_right.serialize(io);
+    io.end_chunk();
 }
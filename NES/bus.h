@@ -6,20 +6,50 @@
 #include "controller.h"
 #include "cpu.h"
 #include "ppu.h"
-#include <QDataStream>
+#include <QByteArray>
 
 class Bus
 {
-    friend QDataStream &operator<<(QDataStream &stream, const Bus &bus); // Serialize
-    friend QDataStream &operator>>(QDataStream &stream, Bus &bus);       // Deserialize
 public:
     Bus();
-    void reset();
+    void reset();    // CPU, PPU, APU, RAM and controllers as at power-on
+    void power_on(); // reset() and the cartridge too: its RAM and mapper registers
+    void soft_reset(); // the reset button: RAM, cartridge and PPU memories kept
     void clock(); // run 1 cycle
+    void run_frame(); // run until the PPU completes a frame, then end the APU's sound frame
+    void end_frame(); // the end of run_frame(), for callers that drive clock() themselves
 
-    void save(quint16 addr, quint8 data); // save data to Bus
-    quint8 load(quint16 addr);            // load data from Bus
+    // CPU memory. RAM and PRG ROM are handled here, inlined into the CPU;
+    // registers and cartridge RAM go on to save_io/load_io.
+    inline void save(quint16 addr, quint8 data); // save data to Bus
+    inline quint8 load(quint16 addr);            // load data from Bus
+    quint8 peek(quint16 addr);            // load without side effects, I/O registers read as 0
     void SetKeyMap();                     // map keyboard to NES
+    quint64 cpu_time() const { return cpu_cycles; } // CPU cycles since reset
+    quint32 frame_number() const { return frames; } // frames run by run_frame() since reset
+
+    // Savestates, see savestate.h. 'out' keeps its capacity between saves.
+    // Loading fails if the state is damaged or belongs to another game, and
+    // then leaves the console as it was.
+    void save_state(QByteArray &out);
+    bool load_state(const QByteArray &in);
+
+    // Hash of everything a savestate holds (CPU, RAM, PPU, OAM, nametables,
+    // palette, APU, mapper registers and RAM). Cheap enough to take every
+    // frame, so two runs can be compared to find where they part.
+    quint64 state_hash();
+
+    // Forking for tree search: the savestate fields back to back in caller
+    // memory, without chunk headers or checks: a copy per field or array,
+    // about a microsecond against milliseconds for a frame.
+    // Only for consoles of the same game in this process. ROM, mapper objects
+    // and the CPU's tables are never copied. See SnapshotPool.
+    int snapshot_size();
+    void clone(char *out);
+    void restore_from(const char *in);
+
+    // CPU writes are recorded here when set, in builds with NES_TRACE defined
+    WriteRing *write_trace = nullptr;
 
 public:
     quint8 ram_data[2048];
@@ -33,16 +63,56 @@ public:
     Controller controller_right;
 
 private:
+    void save_io(quint16 addr, quint8 data); // 0x2000-0xFFFF
+    quint8 load_io(quint16 addr);            // 0x2000-0x7FFF
+    void serialize(StateIO &io);
+    QByteArray hash_buffer; // reused by state_hash()
+    QByteArray load_backup; // reused by load_state()
+
     // record clock cycle cound
     // The frequency of the CPU is 1/3 of the PPUs，so call CPU.clock every 3 cycles.
     quint32 clock_count;
 
+    // CPU cycles since reset, including cycles stalled by DMA. Used as the APU's time base.
+    quint64 cpu_cycles;
+
+    // Frames since reset, part of the state so movies stay in step after loads
+    quint32 frames;
+
     // DMA relevant
     quint8 dma_page = 0x00;    // DMA transfer one page data
     quint8 dma_addr = 0x00;    // page and addr together is a 16bit address
     quint8 dma_data = 0x00;    // Data that will transfer from CPU to OAM
     bool dma_dummy = true;     // You have to wait for clock synchronize while executing DMA
     bool dma_transfer = false; // Flag which tell you DMA is executing
+
+    // Fast DMA: during vertical blank, when the PPU doesn't look at OAM, the
+    // page is copied as soon as the transfer starts and the CPU then just
+    // waits out the 513 or 514 cycles of the byte by byte copy
+    int dma_stall = 0; // cycles still to wait, 0 if no fast DMA is running
+    bool start_fast_dma();
+    void sync_dma_fields();
 };
 
+void Bus::save(quint16 addr, quint8 data)
+{
+#ifdef NES_TRACE
+    if (write_trace)
+        write_trace->record({cpu_cycles, addr, data});
+#endif
+    if (addr < 0x2000)
+        ram_data[addr & 0x7ff] = data;
+    else
+        save_io(addr, data);
+}
+
+quint8 Bus::load(quint16 addr)
+{
+    if (addr < 0x2000)
+        return ram_data[addr & 0x7ff];
+    if (addr >= 0x8000)
+        return cartridge.prg_window(addr)[addr & 0x1fff]; // no mapper here reacts to reads
+    return load_io(addr);
+}
+
 #endif // BUS_H
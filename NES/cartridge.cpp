@@ -3,104 +3,269 @@
 #include <QCryptographicHash>
 #include <QDebug>
 #include <QFile>
-#include <QMessageBox>
+#include <map>
+#include <mutex>
 
-Cartridge::Cartridge()
+Cartridge::Cartridge() : program_data(NULL), vrom_data(NULL), mapper_ptr(NULL)
 {
+    forget_prg_windows();
     reset();
 }
 
-bool Cartridge::read_from_file(QString input_file)
+Cartridge::~Cartridge()
 {
-    // 1. Read file and check validity
-    QFile file(input_file);
-    if (!file.open(QIODevice::ReadOnly)) {
-        QMessageBox::critical(nullptr, QStringLiteral("ERROR"), QStringLiteral("Can't Open file"));
-        return false;
+    reset();
+}
+
+// Images in use, by MD5 and title, so every console playing a game shares
+// one. Entries die with the last console holding the image.
+static std::mutex image_cache_lock;
+static std::map<QByteArray, std::weak_ptr<const RomImage>> image_cache;
+
+// NES 2.0 ROM size: a count of 'unit's with the high nibble from byte 9, or
+// when that nibble is F, 2^E * (2M + 1) bytes from EEEEEEMM in the low byte
+static quint64 rom_size(quint8 lsb, quint8 msb, quint32 unit)
+{
+    if (msb != 0x0f)
+        return quint64((msb << 8) | lsb) * unit;
+    if ((lsb >> 2) > 40) // far beyond any file
+        return quint64(1) << 41;
+    return (quint64(1) << (lsb >> 2)) * ((lsb & 0x03) * 2 + 1);
+}
+
+// NES 2.0 RAM size: 64 << shift bytes, 0 for none
+static quint32 ram_size(quint8 shift)
+{
+    return shift ? 64u << shift : 0;
+}
+
+// Smallest power of two at least 'size', so ROM offsets can be masked
+static quint64 round_up_pow2(quint64 size)
+{
+    quint64 span = 1;
+    while (span < size)
+        span *= 2;
+    return span;
+}
+
+// 'size' bytes of the file, copied and padded with 0xFF to 'padded' bytes
+// when the header gave a size that isn't a power of two of banks
+static QByteArray rom_view(const quint8 *data, quint64 size, quint64 padded)
+{
+    if (size >= padded)
+        return QByteArray::fromRawData((const char *) data, int(size));
+    QByteArray copy((const char *) data, int(size));
+    copy.append(QByteArray(int(padded - size), char(0xff)));
+    return copy;
+}
+
+// Why a ROM can't be used, for callers that want to tell the user
+static void set_error(QString *error, const QString &what)
+{
+    if (error)
+        *error = what;
+}
+
+std::shared_ptr<const RomImage> RomImage::read(const QString &input_file, QString *error)
+{
+    // 1. Map file and check validity
+    std::unique_ptr<QFile> file(new QFile(input_file));
+    if (!file->open(QIODevice::ReadOnly)) {
+        set_error(error, QStringLiteral("Can't Open file"));
+        return nullptr;
     }
 
-    quint8 *nes_data = new quint8[file.size()];
-    file.read((char *) nes_data, file.size());
-    if (nes_data[0] != 'N' || nes_data[1] != 'E' || nes_data[2] != 'S' || nes_data[3] != '\x1A') {
+    // the pages are only read in as the game touches them; files that can't
+    // be mapped (Qt resources, pipes) are read whole instead
+    QByteArray file_data;
+    qint64 file_size = file->size();
+    const quint8 *nes_data = file_size > 0 ? file->map(0, file_size) : nullptr;
+    if (!nes_data) {
+        file_data = file->readAll();
+        file.reset();
+        file_size = file_data.size();
+        nes_data = (const quint8 *) file_data.constData();
+    }
+    if (file_size < 16 || nes_data[0] != 'N' || nes_data[1] != 'E' || nes_data[2] != 'S'
+        || nes_data[3] != '\x1A') {
         qDebug() << "First 4 bytes in file must be NES\\x1A!";
-        QMessageBox::critical(nullptr,
-                              QStringLiteral("ERROR"),
-                              QStringLiteral("This is not a NES rom"));
-        return false;
+        set_error(error, QStringLiteral("This is not a NES rom"));
+        return nullptr;
+    }
+
+    // 2. Deal with the header. NES 2.0 marks itself in byte 7 and widens
+    // the sizes and the mapper number with the bytes iNES left unused.
+    std::shared_ptr<RomImage> rom = std::make_shared<RomImage>();
+    rom->nes2 = (nes_data[7] & 0x0C) == 0x08;
+    rom->nametable_mirror = (nes_data[6] & 0x01) ? MirrorMode::VERTICAL : MirrorMode::HORIZONTAL;
+    rom->battery = nes_data[6] & 0x02;
+    rom->four_screen = nes_data[6] & 0x08;
+    rom->game_title = QString(input_file).toLower().split("/").last().remove(".nes");
+
+    quint64 prg_size, chr_size;
+    if (rom->nes2) {
+        prg_size = rom_size(nes_data[4], nes_data[9] & 0x0f, 16384);
+        chr_size = rom_size(nes_data[5], nes_data[9] >> 4, 8192);
+        rom->mapper_id = ((nes_data[8] & 0x0f) << 8) | (nes_data[7] & 0xf0) | (nes_data[6] >> 4);
+        rom->submapper = nes_data[8] >> 4;
+        rom->prg_ram_size = ram_size(nes_data[10] & 0x0f);
+        rom->prg_nvram_size = ram_size(nes_data[10] >> 4);
+        rom->chr_ram_size = ram_size(nes_data[11] & 0x0f);
+        rom->chr_nvram_size = ram_size(nes_data[11] >> 4);
+        rom->region = RomImage::Region(nes_data[12] & 0x03);
+    } else {
+        // Old dumps often carry junk such as "DiskDude!" from byte 7 on;
+        // only trust it when the last four bytes are clear
+        bool clean = !nes_data[12] && !nes_data[13] && !nes_data[14] && !nes_data[15];
+        prg_size = nes_data[4] * 16384;
+        chr_size = nes_data[5] * 8192;
+        rom->mapper_id = (clean ? nes_data[7] & 0xf0 : 0) | (nes_data[6] >> 4);
+        rom->submapper = 0;
+        rom->prg_ram_size = (clean && nes_data[8] ? nes_data[8] : 1) * 0x2000;
+        rom->prg_nvram_size = 0;
+        rom->chr_ram_size = chr_size ? 0 : 0x2000;
+        rom->chr_nvram_size = 0;
+        rom->region = clean && (nes_data[9] & 0x01) ? RomImage::PAL : RomImage::NTSC;
     }
-    game_title = input_file.toLower().split("/").last().remove(".nes");
+    rom->rom_num = quint16((prg_size + 16383) / 16384);
+    rom->vrom_num = quint16((chr_size + 8191) / 8192);
+
+    // the trainer, if any, sits between the header and PRG_Data
+    quint64 trainer_dx = 16;
+    quint64 rom_start_dx = trainer_dx + ((nes_data[6] & 0x04) ? 512 : 0);
+    quint64 vrom_start_dx = rom_start_dx + prg_size;
+    if (prg_size == 0 || quint64(file_size) < vrom_start_dx + chr_size) {
+        qDebug() << "ROM file is shorter than its header says";
+        set_error(error, QStringLiteral("This is not a NES rom"));
+        return nullptr;
+    }
+
+    // 3. Hand out the image already in use, if any
+    QCryptographicHash md5(QCryptographicHash::Md5);
+    md5.addData((const char *) nes_data, int(file_size));
+    rom->md5_val = md5.result().toHex();
+    QByteArray key = rom->md5_val + "/" + rom->game_title.toUtf8();
 
-    file.seek(0); // get MD5 value
-    md5_val = QCryptographicHash::hash(file.readAll(), QCryptographicHash::Md5).toHex();
-    file.close();
+    std::lock_guard<std::mutex> guard(image_cache_lock);
+    if (std::shared_ptr<const RomImage> shared = image_cache[key].lock())
+        return shared;
 
-    // 2. Deal with the header
-    rom_num = nes_data[4];
-    vrom_num = nes_data[5];
-    quint8 nametable_mirror = nes_data[6] & 0xb;
-    mapper_id = (nes_data[7] & 0xf0) | ((nes_data[6] >> 4) & 0x0f);
-    prg_ram_size = nes_data[8];
+    // 4. PRG_Data and CHR_Data are views into the file
+    rom->trainer = rom_view(nes_data + trainer_dx, rom_start_dx - trainer_dx, 0);
+    quint64 prg_padded = round_up_pow2(rom->rom_num * 16384);
+    quint64 chr_padded = chr_size ? round_up_pow2(rom->vrom_num * 8192) : 0;
+    rom->program = rom_view(nes_data + rom_start_dx, prg_size, prg_padded);
+    rom->vrom = rom_view(nes_data + vrom_start_dx, chr_size, chr_padded);
+    rom->file = std::move(file);
+    rom->file_data = std::move(file_data);
 
-    // 3. Deal with Mapper infos
-    switch (mapper_id) {
+    for (auto it = image_cache.begin(); it != image_cache.end();) {
+        if (it->second.expired())
+            it = image_cache.erase(it);
+        else
+            ++it;
+    }
+    image_cache[key] = rom;
+    return rom;
+}
+
+// Offsets into RAM of 'size' bytes repeat every power of two that fits
+static quint32 mirror_mask(quint32 size)
+{
+    quint32 span = 1;
+    while (span * 2 <= size)
+        span *= 2;
+    return size ? span - 1 : 0;
+}
+
+bool Cartridge::read_from_file(QString input_file, QString *error)
+{
+    std::shared_ptr<const RomImage> rom = RomImage::read(input_file, error);
+    return rom && load_image(rom, error);
+}
+
+bool Cartridge::load_image(std::shared_ptr<const RomImage> rom, QString *error)
+{
+    reset();
+
+    // Deal with Mapper infos
+    switch (rom->mapper_id) {
     case 0:
-        mapper_ptr = new Mapper0(rom_num, vrom_num);
-        mapper_ptr->nametable_mirror = nametable_mirror;
+        mapper_ptr = new Mapper0(rom->rom_num, rom->vrom_num);
         break;
     case 1:
-        mapper_ptr = new Mapper1(rom_num, vrom_num);
-        mapper_ptr->nametable_mirror = nametable_mirror;
+        mapper_ptr = new Mapper1(rom->rom_num, rom->vrom_num);
         break;
     case 2:
-        mapper_ptr = new Mapper2(rom_num, vrom_num);
-        mapper_ptr->nametable_mirror = nametable_mirror;
+        mapper_ptr = new Mapper2(rom->rom_num, rom->vrom_num);
         break;
-
     case 3:
-        mapper_ptr = new Mapper3(rom_num, vrom_num);
-        mapper_ptr->nametable_mirror = nametable_mirror;
+        mapper_ptr = new Mapper3(rom->rom_num, rom->vrom_num);
         break;
-
     case 4:
-        mapper_ptr = new Mapper4(rom_num, vrom_num);
-        mapper_ptr->nametable_mirror = nametable_mirror;
+        mapper_ptr = new Mapper4(rom->rom_num, rom->vrom_num);
         break;
-
     case 66:
-        mapper_ptr = new Mapper66(rom_num, vrom_num);
-        mapper_ptr->nametable_mirror = nametable_mirror;
+        mapper_ptr = new Mapper66(rom->rom_num, rom->vrom_num);
         break;
-
     default:
-        qDebug() << "Unsupported Mapper = " << mapper_id;
-        QMessageBox::critical(nullptr,
-                              QStringLiteral("ERROR"),
-                              QStringLiteral(
-                                  "The Mapper this game used aren't currently supported"));
+        qDebug() << "Unsupported Mapper = " << rom->mapper_id;
+        set_error(error, QStringLiteral("The Mapper this game used aren't currently supported"));
         return false;
     }
+    mapper_ptr->nametable_mirror = rom->nametable_mirror;
+
+    // Cartridge RAM as the header sizes it. A board without CHR ROM always
+    // has pattern table RAM, even if the header forgot to say how much.
+    quint32 addram_size = rom->prg_ram_size + rom->prg_nvram_size;
+    quint32 chr_ram_size = 0;
+    if (rom->vrom_num == 0) {
+        chr_ram_size = rom->chr_ram_size + rom->chr_nvram_size;
+        if (chr_ram_size == 0)
+            chr_ram_size = 0x2000;
+    }
+    quint32 nametable_size = rom->four_screen ? Mapper::nametable_ram_size : 0;
 
-    // 4. read PRG_Data and CHR_Data
-    quint32 rom_start_dx = 16;
-    quint32 vrom_start_dx = rom_num * 16384 + 16;
-    program_data = new quint8[16384 * rom_num];
-    memcpy(program_data, &nes_data[rom_start_dx], 16384 * rom_num);
-    vrom_data = new quint8[8192 * vrom_num];
-    memcpy(vrom_data, &nes_data[vrom_start_dx], 8192 * vrom_num);
+    quint8 *ram = arena(addram_size + chr_ram_size + nametable_size);
+    mapper_ptr->addram = ram;
+    mapper_ptr->addram_size = addram_size;
+    mapper_ptr->character_ram_ptr = chr_ram_size ? ram + addram_size : nullptr;
+    mapper_ptr->character_ram_size = chr_ram_size;
+    mapper_ptr->nametable_ram = nametable_size ? ram + addram_size + chr_ram_size : nullptr;
+    addram_mask = mirror_mask(addram_size);
+    character_ram_mask = mirror_mask(chr_ram_size);
+    if (rom->trainer.size() && addram_size >= 0x2000)
+        memcpy(mapper_ptr->addram + 0x1000, rom->trainer.constData(), rom->trainer.size());
+
+    image = rom;
+    rom_num = rom->rom_num;
+    vrom_num = rom->vrom_num;
+    mapper_id = rom->mapper_id;
+    prg_ram_size = addram_size;
+    game_title = rom->game_title;
+    md5_val = rom->md5_val;
+    program_data = (const quint8 *) rom->program.constData();
+    vrom_data = (const quint8 *) rom->vrom.constData();
+    program_mask = rom->program.size() - 1;
+    vrom_mask = rom->vrom.size() ? rom->vrom.size() - 1 : 0;
+    forget_prg_windows();
     return true;
 }
 
+void Cartridge::power_on()
+{
+    // a new mapper object and a freshly zeroed arena, as when inserted
+    std::shared_ptr<const RomImage> rom = image;
+    if (rom)
+        load_image(rom);
+}
+
 void Cartridge::reset()
 {
-    if (program_data) {
-        delete[] program_data;
-    }
+    image.reset();
     program_data = NULL;
-
-    if (vrom_data) {
-        delete[] vrom_data;
-    }
     vrom_data = NULL;
+    forget_prg_windows();
 
     game_title.clear();
     md5_val.clear();
@@ -108,22 +273,36 @@ void Cartridge::reset()
     vrom_num = 0;
     mapper_id = 0;
     prg_ram_size = 0;
+    addram_mask = 0;
+    character_ram_mask = 0;
+    program_mask = 0;
+    vrom_mask = 0;
     if (mapper_ptr)
         delete mapper_ptr;
     mapper_ptr = NULL;
 }
 
+quint8 *Cartridge::arena(int size)
+{
+    if (int(arena_storage.size()) < size + 63)
+        arena_storage.resize(size + 63);
+    quint8 *block = (quint8 *) ((quintptr(arena_storage.data()) + 63) & ~quintptr(63));
+    memset(block, 0, size);
+    return block;
+}
+
 void Cartridge::CpuWrite(quint16 addr, quint8 data)
 {
     quint32 mapped_addr = 0;
     if (addr >= 0x6000 && addr < 0x8000) {
         mapped_addr = mapper_ptr->cpu_write_addram(addr, data);
-        if (mapped_addr != 0xFFFF)
-            mapper_ptr->addram[mapped_addr] = data;
+        if (mapped_addr != 0xFFFF && mapper_ptr->addram_size)
+            mapper_ptr->addram[mapped_addr & addram_mask] = data;
     } else if (addr >= 0x8000 && addr <= 0xFFFF) {
         // Mapper won't change program_data
         // but will modify it's own registers
         mapper_ptr->cpu_write_prg(addr, data);
+        forget_prg_windows();
     }
 }
 
@@ -132,11 +311,11 @@ quint8 Cartridge::CpuRead(quint16 addr)
     quint32 mapped_addr = 0;
     if (addr >= 0x6000 && addr < 0x8000) {
         mapped_addr = mapper_ptr->cpu_read_addram(addr);
-        if (mapped_addr != 0xFFFF)
-            return mapper_ptr->addram[mapped_addr];
+        if (mapped_addr != 0xFFFF && mapper_ptr->addram_size)
+            return mapper_ptr->addram[mapped_addr & addram_mask];
     } else if (addr >= 0x8000 && addr <= 0xFFFF) {
         mapped_addr = mapper_ptr->cpu_read_prg(addr);
-        return program_data[mapped_addr];
+        return program_data[mapped_addr & program_mask];
     }
 
     return 0;
@@ -149,7 +328,7 @@ void Cartridge::PpuWrite(quint16 addr, quint8 data)
     mapped_addr = mapper_ptr->ppu_write_pt(addr, data);
 
     if (vrom_num == 0)
-        mapper_ptr->character_ram_ptr[mapped_addr] = data;
+        mapper_ptr->character_ram_ptr[mapped_addr & character_ram_mask] = data;
     else
         qDebug() << "cartridge's vrom is ReadOnly";
 }
@@ -161,7 +340,7 @@ quint8 Cartridge::PpuRead(quint16 addr)
     mapped_addr = mapper_ptr->ppu_read_pt(addr);
 
     if (vrom_num != 0)
-        return vrom_data[mapped_addr];
+        return vrom_data[mapped_addr & vrom_mask];
     else
-        return mapper_ptr->character_ram_ptr[mapped_addr];
+        return mapper_ptr->character_ram_ptr[mapped_addr & character_ram_mask];
 }
@@ -8,34 +8,115 @@
 #include "Mapper/mapper_3.h"
 #include "Mapper/mapper_4.h"
 #include "Mapper/mapper_66.h"
+#include <QByteArray>
+#include <QFile>
 #include <QString>
 #include <QtGlobal>
+#include <memory>
+#include <vector>
+
+// The parts of a ROM file that never change. Consoles playing the same game
+// share one, so N of them don't hold N copies of PRG and CHR: read() hands
+// out the image already in use when the file's MD5 (and title) match.
+struct RomImage
+{
+    // CPU/PPU timing the game was made for (NES 2.0 byte 12). Only NTSC is
+    // emulated; the others are kept for the front end to show.
+    enum Region { NTSC = 0, PAL = 1, MultiRegion = 2, Dendy = 3 };
+
+    bool nes2;               // NES 2.0 header, else iNES
+    quint16 rom_num;         // PRG_ROM num（16KB each block）
+    quint16 vrom_num;        // CHR_ROM num（8KB each block）
+    quint16 mapper_id;
+    quint8 submapper;        // NES 2.0 only, 0 otherwise
+    quint8 nametable_mirror; // HORIZONTAL or VERTICAL
+    bool four_screen;        // the board has its own 2KB for two more nametables
+    bool battery;            // PRG RAM (or NVRAM) survives power off
+    quint32 prg_ram_size;    // bytes at 0x6000, iNES: 8KB unless the header says more
+    quint32 prg_nvram_size;  // battery-backed bytes, NES 2.0 only
+    quint32 chr_ram_size;    // bytes, iNES: 8KB when there is no CHR ROM
+    quint32 chr_nvram_size;  // NES 2.0 only
+    Region region;
+    QByteArray trainer;      // 512 bytes the board loads at 0x7000, empty if none
+    QByteArray program;      // PRG_Data, a view into the file
+    QByteArray vrom;         // CHR_Data, a view into the file
+    QString game_title;
+    QByteArray md5_val;
+
+    // The file mapped read-only, or its contents in file_data where it can't
+    // be mapped. program and vrom point into one of them.
+    std::unique_ptr<QFile> file;
+    QByteArray file_data;
+
+    // nullptr if the file can't be used, with the reason for the user in *error
+    static std::shared_ptr<const RomImage> read(const QString &input_file,
+                                                QString *error = nullptr);
+};
 
 class Cartridge
 {
 public:
-    quint8 rom_num;       // PRG_ROM num（16KB each block）
-    quint8 vrom_num;      // CHR_ROM num（8KB each block）
-    quint8 *program_data; // PRG_Data
-    quint8 *vrom_data;    // CHR_Data
+    quint16 rom_num;            // PRG_ROM num（16KB each block）
+    quint16 vrom_num;           // CHR_ROM num（8KB each block）
+    const quint8 *program_data; // PRG_Data, owned by image
+    const quint8 *vrom_data;    // CHR_Data, owned by image
     QString game_title;   // game_title for Savefile
     QByteArray md5_val;   // MD5 value for Savefile verify
 
     // Mapper infos
-    quint8 mapper_id;    // Which Mapper
-    quint8 prg_ram_size; // rarely used, you can ignore it for now
-    Mapper *mapper_ptr;  // Mapper pointer
+    quint16 mapper_id;    // Which Mapper
+    quint32 prg_ram_size; // PRG RAM and NVRAM bytes at 0x6000
+    Mapper *mapper_ptr;   // Mapper pointer
 
 public:
     Cartridge();
-    bool read_from_file(QString input_file);
+    ~Cartridge();
+    // Both fail with the reason for the user in *error, if given.
+    // load_image() inserts an already read ROM.
+    bool read_from_file(QString input_file, QString *error = nullptr);
+    bool load_image(std::shared_ptr<const RomImage> rom, QString *error = nullptr);
+    std::shared_ptr<const RomImage> rom_image() const { return image; }
     void reset();
+    void power_on(); // the inserted game as just loaded: RAM cleared, mapper registers reset
 
     void CpuWrite(quint16 addr, quint8 data);
     quint8 CpuRead(quint16 addr);
 
     void PpuWrite(quint16 addr, quint8 data);
     quint8 PpuRead(quint16 addr);
+
+    // The PRG bytes each 8KB of 0x8000-0xFFFF shows now, for reading code
+    // without going through the mapper every time. Every mapper here switches
+    // PRG in 8KB steps or more, and only when written to.
+    const quint8 *prg_window(quint16 addr)
+    {
+        const quint8 *&window = prg_windows[(addr >> 13) & 3];
+        if (!window)
+            window = program_data + (mapper_ptr->cpu_read_prg(addr & 0xE000) & program_mask);
+        return window;
+    }
+    void forget_prg_windows() { prg_windows[0] = prg_windows[1] = prg_windows[2] = prg_windows[3] = NULL; }
+
+private:
+    std::shared_ptr<const RomImage> image;
+    const quint8 *prg_windows[4]; // looked up on first use, NULL until then
+
+    // The console's cartridge RAM in one cache line aligned block, kept from
+    // game to game so reloading doesn't allocate: the mapper's addram, then
+    // its pattern table RAM if there is no CHR ROM, then the four-screen
+    // nametables, each as big as the header says. Only cartridge RAM lives
+    // here: the console's own RAM, VRAM and chip registers stay members of
+    // Bus, PPU and CPU, where the per-dot code reaches them without a pointer
+    std::vector<quint8> arena_storage;
+    quint8 *arena(int size); // 'size' zeroed bytes at the start of the block
+
+    // Offsets from the mapper wrap around RAM smaller than what it addresses,
+    // and around ROM too: a bank number past the end mirrors, as the missing
+    // address lines do on the board, instead of reading past the file
+    quint32 addram_mask;
+    quint32 character_ram_mask;
+    quint32 program_mask; // PRG and CHR are padded to a power of two
+    quint32 vrom_mask;
 };
 
 #endif // CARTRIDGE_H
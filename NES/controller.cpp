@@ -1,4 +1,5 @@
 #include "controller.h"
+#include "savestate.h"
 #include <QDebug>
 
 void Controller::init()
@@ -16,6 +17,21 @@ void Controller::get_key_states()
         if (cur_keystate[key_id])
             keystate |= (1 << key_id);
     }
+    if (latch_hook)
+        keystate = latch_hook(hook_data, hook_port, keystate);
+}
+
+void Controller::set_buttons(quint8 buttons)
+{
+    for (int key_id = FC_KEY_A; key_id <= FC_KEY_RIGHT; key_id++)
+        cur_keystate[key_id] = (buttons >> key_id) & 1;
+}
+
+void Controller::set_latch_hook(LatchHook hook, void *user_data, int port)
+{
+    latch_hook = hook;
+    hook_data = user_data;
+    hook_port = port;
 }
 
 void Controller::write_strobe(quint8 data)
@@ -33,7 +49,8 @@ quint8 Controller::output_key_states()
     bool is_key_pressed = false;
     if (strobe) {
         // if strobe is on, output real time keystate
-        is_key_pressed = cur_keystate[FC_KEY_A];
+        get_key_states();
+        is_key_pressed = keystate & 1;
     } else {
         // if strobe isn't on, output cached keystate
         is_key_pressed = keystate & 1;
@@ -42,3 +59,9 @@ quint8 Controller::output_key_states()
     }
     return (0x40 | is_key_pressed);
 }
+
+void Controller::serialize(StateIO &io)
+{
+    io.pod(strobe);
+    io.pod(keystate);
+}
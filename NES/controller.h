@@ -13,13 +13,24 @@
 #define FC_KEY_LEFT 6
 #define FC_KEY_RIGHT 7
 
+class StateIO;
+
 class Controller
 {
+public:
+    // Lets a movie see or replace the buttons each time the game latches them
+    typedef quint8 (*LatchHook)(void *user_data, int port, quint8 buttons);
+    void set_latch_hook(LatchHook hook, void *user_data, int port);
+
 private:
     // registers
     bool strobe;     // whether strobe is on or not
     quint8 keystate; // save the keystate
 
+    LatchHook latch_hook = nullptr;
+    void *hook_data = nullptr;
+    int hook_port = 0;
+
 public:
     // interface for CPU to call
     void write_strobe(quint8 data);
@@ -28,6 +39,8 @@ public:
 public:
     void init();
     void get_key_states();     // return realtime keystate or cached keystate based on strobe
+    void set_buttons(quint8 buttons); // set cur_keystate from a byte, bit n = FC_KEY n
+    void serialize(StateIO &io); // save/load state
     QMap<int, quint8> key_map; // Key Mapping, maybe should allow users to change
     bool cur_keystate[8];      // real time key state
 };
@@ -0,0 +1,72 @@
+# Emulator core shared by the GUI and the tools: everything but the windows.
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/Mapper/mapper_0.cpp \
+    $$PWD/Mapper/mapper_1.cpp \
+    $$PWD/Mapper/mapper_2.cpp \
+    $$PWD/Mapper/mapper_3.cpp \
+    $$PWD/Mapper/mapper_4.cpp \
+    $$PWD/Mapper/mapper_66.cpp \
+    $$PWD/Simple_Apu.cpp \
+    $$PWD/bus.cpp \
+    $$PWD/cartridge.cpp \
+    $$PWD/controller.cpp \
+    $$PWD/cpu.cpp \
+    $$PWD/movie.cpp \
+    $$PWD/nes_apu/Blip_Buffer.cpp \
+    $$PWD/nes_apu/Blip_Simd.cpp \
+    $$PWD/nes_apu/Multi_Buffer.cpp \
+    $$PWD/nes_apu/Nes_Apu.cpp \
+    $$PWD/nes_apu/Nes_Namco.cpp \
+    $$PWD/nes_apu/Nes_Oscs.cpp \
+    $$PWD/nes_apu/Nes_Vrc6.cpp \
+    $$PWD/nes_apu/Nonlinear_Buffer.cpp \
+    $$PWD/nes_apu/apu_snapshot.cpp \
+    $$PWD/observation.cpp \
+    $$PWD/ppu.cpp \
+    $$PWD/rewind.cpp \
+    $$PWD/runahead.cpp \
+    $$PWD/savestate.cpp \
+    $$PWD/snapshotpool.cpp \
+    $$PWD/vecenv.cpp
+
+HEADERS += \
+    $$PWD/Mapper/mapper.h \
+    $$PWD/Mapper/mapper_0.h \
+    $$PWD/Mapper/mapper_1.h \
+    $$PWD/Mapper/mapper_2.h \
+    $$PWD/Mapper/mapper_3.h \
+    $$PWD/Mapper/mapper_4.h \
+    $$PWD/Mapper/mapper_66.h \
+    $$PWD/Simple_Apu.h \
+    $$PWD/boost/config.hpp \
+    $$PWD/boost/cstdint.hpp \
+    $$PWD/boost/static_assert.hpp \
+    $$PWD/bus.h \
+    $$PWD/cartridge.h \
+    $$PWD/controller.h \
+    $$PWD/cpu.h \
+    $$PWD/movie.h \
+    $$PWD/nes_apu/Blip_Buffer.h \
+    $$PWD/nes_apu/Blip_Simd.h \
+    $$PWD/nes_apu/Blip_Synth.h \
+    $$PWD/nes_apu/Multi_Buffer.h \
+    $$PWD/nes_apu/Nes_Apu.h \
+    $$PWD/nes_apu/Nes_Namco.h \
+    $$PWD/nes_apu/Nes_Oscs.h \
+    $$PWD/nes_apu/Nes_Vrc6.h \
+    $$PWD/nes_apu/Nonlinear_Buffer.h \
+    $$PWD/nes_apu/apu_snapshot.h \
+    $$PWD/nes_apu/blargg_common.h \
+    $$PWD/nes_apu/blargg_source.h \
+    $$PWD/observation.h \
+    $$PWD/palette.h \
+    $$PWD/ppu.h \
+    $$PWD/rewind.h \
+    $$PWD/runahead.h \
+    $$PWD/savestate.h \
+    $$PWD/snapshotpool.h \
+    $$PWD/trace.h \
+    $$PWD/vecenv.h
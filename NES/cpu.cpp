@@ -1,12 +1,35 @@
 #include "cpu.h"
 #include "bus.h"
+#include "savestate.h"
 #include <QDebug>
-#include <QMessageBox>
 
-CPU::CPU(Bus *bus) : addr_abs(0), addr_rel(0), cycles_wait(0), opcode(0), clock_count(0)
+CPU::CPU(Bus *bus)
+    : reg_a(0), reg_x(0), reg_y(0), reg_pc(0), reg_sp(0xFD), addr_abs(0), addr_rel(0),
+      cycles_wait(0), opcode(0), clock_count(0), oprand_for_log(0), address_mode(0)
 {
+    reg_sf.set(0);
     isDebugging = false;
     this->p_ram = bus;
+
+    // What a wait loop may contain: reads, compares, branches and flag or
+    // register moves. Nothing that writes memory or touches the stack.
+    for (int op = 0; op < 256; op++) {
+        const Instruction &inst = inst_table[op];
+        int (CPU::*f)() = inst.operate;
+        bool memory = inst.addrmode != &CPU::IMP && inst.addrmode != &CPU::IMM;
+        if (f == &CPU::LDA || f == &CPU::LDX || f == &CPU::LDY || f == &CPU::BIT || f == &CPU::CMP
+            || f == &CPU::CPX || f == &CPU::CPY || f == &CPU::AND || f == &CPU::ORA || f == &CPU::EOR
+            || f == &CPU::ADC || f == &CPU::SBC)
+            idle_kind[op] = memory ? IdleRead : IdleSafe;
+        else if (inst.addrmode == &CPU::REL || (f == &CPU::JMP && inst.addrmode == &CPU::ABS))
+            idle_kind[op] = IdleJump;
+        else if ((f == &CPU::NOP && !memory) || f == &CPU::CLC || f == &CPU::SEC || f == &CPU::CLV
+                 || f == &CPU::TAX || f == &CPU::TAY || f == &CPU::TXA || f == &CPU::TYA
+                 || f == &CPU::INX || f == &CPU::INY || f == &CPU::DEX || f == &CPU::DEY)
+            idle_kind[op] = IdleSafe;
+        else
+            idle_kind[op] = IdleUnsafe;
+    }
 }
 
 void CPU::connectToBus(Bus *bus)
@@ -16,14 +39,8 @@ void CPU::connectToBus(Bus *bus)
 
 void CPU::push_stack(quint8 value)
 {
-    if (reg_sp == 0) {
-        QMessageBox::critical(nullptr,
-                              QStringLiteral("ERROR"),
-                              QStringLiteral("Stack Overflow! Exiting..."));
-        abort();
-    }
     // 0-255 is Zero Page
-    // Stack start from 256, so the offset is 0x100
+    // Stack start from 256, so the offset is 0x100. SP wraps within the page.
     p_ram->save(reg_sp + 0x100, value);
     reg_sp--;
 }
@@ -41,8 +58,7 @@ void CPU::reset()
     reg_x = 0;
     reg_y = 0;
     reg_sp = 0xfd;
-    reg_sf.set_i(true); // block IRQ
-    reg_sf.set_u(true);
+    reg_sf.set(StatusFlag::U | StatusFlag::I); // block IRQ
 
     // Little-endian
     quint8 lo8 = p_ram->load(0xFFFC);
@@ -50,8 +66,28 @@ void CPU::reset()
     reg_pc = quint16(hi8 << 8) + lo8;
     addr_abs = 0;
     addr_rel = 0;
+    opcode = 0;
+    clock_count = 0;
 
     cycles_wait = 8;
+    jammed = false;
+    forget_idle_loop();
+    idle_cycles = 0;
+}
+
+void CPU::soft_reset()
+{
+    // the reset sequence is an interrupt whose three pushes are turned into
+    // reads, so only SP and I change before the vector is fetched
+    reg_sp -= 3;
+    reg_sf.set_i(true);
+
+    quint8 lo8 = p_ram->load(0xFFFC);
+    quint8 hi8 = p_ram->load(0xFFFD);
+    reg_pc = quint16(hi8 << 8) + lo8;
+    cycles_wait = 7;
+    jammed = false;
+    forget_idle_loop();
 }
 
 void CPU::irq()
@@ -63,8 +99,7 @@ void CPU::irq()
         push_stack(reg_pc >> 8);
         push_stack(reg_pc & 0xFF);
         reg_sf.set_b(false);
-        reg_sf.set_u(true);
-        push_stack(reg_sf.data);
+        push_stack(reg_sf.get());
         reg_sf.set_i(true); // disable interrupt
         // 2. Load Interrupt handling program
         quint8 lo8 = p_ram->load(0xFFFE);
@@ -81,8 +116,7 @@ void CPU::nmi()
     push_stack(reg_pc >> 8);
     push_stack(reg_pc & 0xFF);
     reg_sf.set_b(false);
-    reg_sf.set_u(true);
-    push_stack(reg_sf.data);
+    push_stack(reg_sf.get());
     reg_sf.set_i(true);
     // 2. Load Interrupt handling program
     quint8 lo8 = p_ram->load(0xFFFA);
@@ -247,8 +281,7 @@ int CPU::ADC()
     quint16 sum = reg_a + operand + reg_sf.get_c();
     reg_sf.set_c(sum >= 256);
     reg_sf.set_v((reg_a ^ sum) & (operand ^ sum) & 0x80);
-    reg_sf.set_z((sum & 0xFF) == 0);
-    reg_sf.set_n(sum & 0x80);
+    reg_sf.set_nz(quint8(sum));
     reg_a = sum & 0xFF;
     return 1;
 }
@@ -259,8 +292,7 @@ int CPU::AND()
     quint8 operand = p_ram->load(addr_abs);
     // And
     reg_a = reg_a & operand;
-    reg_sf.set_z(reg_a == 0);
-    reg_sf.set_n(reg_a & 0x80);
+    reg_sf.set_nz(reg_a);
     return 1;
 }
 
@@ -271,16 +303,14 @@ int CPU::ASL()
         // IMP(Accumulator)
         quint16 temp = quint16(reg_a << 1);
         reg_sf.set_c(temp >= 0x100);
-        reg_sf.set_z((temp & 0x00FF) == 0);
-        reg_sf.set_n(temp & 0x80);
+        reg_sf.set_nz(quint8(temp));
         reg_a = temp & 0x00FF;
     } else {
         // fetch data
         quint8 operand = p_ram->load(addr_abs);
         quint16 temp = quint16(operand << 1);
         reg_sf.set_c(temp >= 0x100);
-        reg_sf.set_z((temp & 0x00FF) == 0);
-        reg_sf.set_n(temp & 0x80);
+        reg_sf.set_nz(quint8(temp));
         p_ram->save(addr_abs, temp & 0x00FF);
     }
     return 0;
@@ -407,7 +437,7 @@ int CPU::BRK()
     push_stack(reg_pc & 0xFF);
     reg_sf.set_b(true);
     reg_sf.set_i(true);
-    push_stack(reg_sf.data);
+    push_stack(reg_sf.get());
     reg_sf.set_b(false);
     // 2. Load Interrupt handling program
     quint8 lo8 = p_ram->load(0xFFFE);
@@ -484,8 +514,7 @@ int CPU::CMP()
     // compare with Accumulator
     quint16 temp = reg_a - operand;
     reg_sf.set_c(reg_a >= operand);
-    reg_sf.set_z((temp & 0x00FF) == 0);
-    reg_sf.set_n(bool(temp & 0x0080));
+    reg_sf.set_nz(quint8(temp));
     return 1;
 }
 
@@ -496,8 +525,7 @@ int CPU::CPX()
     // compare with X
     quint16 temp = reg_x - operand;
     reg_sf.set_c(reg_x >= operand);
-    reg_sf.set_z((temp & 0x00FF) == 0);
-    reg_sf.set_n(bool(temp & 0x0080));
+    reg_sf.set_nz(quint8(temp));
     return 0;
 }
 
@@ -508,8 +536,7 @@ int CPU::CPY()
     // compare with Y
     quint16 temp = reg_y - operand;
     reg_sf.set_c(reg_y >= operand);
-    reg_sf.set_z((temp & 0x00FF) == 0);
-    reg_sf.set_n(bool(temp & 0x0080)); //
+    reg_sf.set_nz(quint8(temp));
     return 0;
 }
 
@@ -520,8 +547,7 @@ int CPU::DEC()
     // Decrement memory
     quint16 res = operand - 1;
     p_ram->save(addr_abs, res & 0x00FF);
-    reg_sf.set_z((res & 0x00FF) == 0);
-    reg_sf.set_n(bool(res & 0x0080));
+    reg_sf.set_nz(quint8(res));
     return 0;
 }
 
@@ -529,8 +555,7 @@ int CPU::DEX()
 {
     // X--
     reg_x--;
-    reg_sf.set_z(reg_x == 0);
-    reg_sf.set_n(bool(reg_x & 0x0080));
+    reg_sf.set_nz(reg_x);
     return 0;
 }
 
@@ -538,8 +563,7 @@ int CPU::DEY()
 {
     // Y--
     reg_y--;
-    reg_sf.set_z(reg_y == 0);
-    reg_sf.set_n(bool(reg_y & 0x0080));
+    reg_sf.set_nz(reg_y);
     return 0;
 }
 
@@ -549,8 +573,7 @@ int CPU::EOR()
     quint8 operand = p_ram->load(addr_abs);
     // xor
     reg_a = reg_a ^ operand;
-    reg_sf.set_z(reg_a == 0);
-    reg_sf.set_n(bool(reg_a & 0x0080));
+    reg_sf.set_nz(reg_a);
     return 1;
 }
 
@@ -561,8 +584,7 @@ int CPU::INC()
     // Increment Memory
     quint16 res = operand + 1;
     p_ram->save(addr_abs, res & 0x00FF);
-    reg_sf.set_z((res & 0x00FF) == 0);
-    reg_sf.set_n(bool(res & 0x0080));
+    reg_sf.set_nz(quint8(res));
     return 0;
 }
 
@@ -570,8 +592,7 @@ int CPU::INX()
 {
     // X++
     reg_x++;
-    reg_sf.set_z(reg_x == 0);
-    reg_sf.set_n(bool(reg_x & 0x0080));
+    reg_sf.set_nz(reg_x);
     return 0;
 }
 
@@ -579,8 +600,7 @@ int CPU::INY()
 {
     // Y++
     reg_y++;
-    reg_sf.set_z(reg_y == 0);
-    reg_sf.set_n(bool(reg_y & 0x0080));
+    reg_sf.set_nz(reg_y);
     return 0;
 }
 
@@ -607,8 +627,7 @@ int CPU::LDA()
     quint8 operand = p_ram->load(addr_abs);
     // Load Accumulator
     reg_a = operand;
-    reg_sf.set_z(reg_a == 0);
-    reg_sf.set_n(bool(reg_a & 0x0080));
+    reg_sf.set_nz(reg_a);
     return 1;
 }
 
@@ -618,8 +637,7 @@ int CPU::LDX()
     quint8 operand = p_ram->load(addr_abs);
     // Load X
     reg_x = operand;
-    reg_sf.set_z(reg_x == 0);
-    reg_sf.set_n(bool(reg_x & 0x0080));
+    reg_sf.set_nz(reg_x);
     return 1;
 }
 
@@ -629,8 +647,7 @@ int CPU::LDY()
     quint8 operand = p_ram->load(addr_abs);
     // Load Y
     reg_y = operand;
-    reg_sf.set_z(reg_y == 0);
-    reg_sf.set_n(bool(reg_y & 0x0080));
+    reg_sf.set_nz(reg_y);
     return 1;
 }
 
@@ -641,16 +658,14 @@ int CPU::LSR()
         //IMP(Accumulator)
         quint16 temp = quint16(reg_a >> 1);
         reg_sf.set_c(reg_a & 0x0001);
-        reg_sf.set_z((temp & 0x00FF) == 0);
-        reg_sf.set_n(temp & 0x80);
+        reg_sf.set_nz(quint8(temp));
         reg_a = temp & 0x00FF;
     } else {
         // fetch data
         quint8 operand = p_ram->load(addr_abs);
         quint16 temp = quint16(operand >> 1);
         reg_sf.set_c(operand & 0x0001);
-        reg_sf.set_z((temp & 0x00FF) == 0);
-        reg_sf.set_n(temp & 0x80);
+        reg_sf.set_nz(quint8(temp));
         p_ram->save(addr_abs, temp & 0x00FF);
     }
     return 0;
@@ -678,8 +693,7 @@ int CPU::ORA()
     quint8 operand = p_ram->load(addr_abs);
     // Or
     reg_a = reg_a | operand;
-    reg_sf.set_z(reg_a == 0);
-    reg_sf.set_n(bool(reg_a & 0x0080));
+    reg_sf.set_nz(reg_a);
     return 1;
 }
 
@@ -693,9 +707,8 @@ int CPU::PHA()
 int CPU::PHP()
 {
     // Push Status
-    push_stack(reg_sf.data | (1 << 4) | (1 << 5));
+    push_stack(reg_sf.get() | (1 << 4) | (1 << 5));
     reg_sf.set_b(false);
-    reg_sf.set_u(false);
     return 0;
 }
 
@@ -703,16 +716,14 @@ int CPU::PLA()
 {
     // Pull Accumulator
     reg_a = pull_stack();
-    reg_sf.set_z(reg_a == 0);
-    reg_sf.set_n(bool(reg_a & 0x0080));
+    reg_sf.set_nz(reg_a);
     return 0;
 }
 
 int CPU::PLP()
 {
     // Pull Status
-    reg_sf.data = pull_stack();
-    reg_sf.set_u(true);
+    reg_sf.set(pull_stack());
     return 0;
 }
 
@@ -723,16 +734,14 @@ int CPU::ROL()
         // IMP(Accumulator)
         quint16 temp = quint16(reg_a << 1) | reg_sf.get_c(); //
         reg_sf.set_c(temp >= 0x100);
-        reg_sf.set_z((temp & 0x00FF) == 0);
-        reg_sf.set_n(temp & 0x80);
+        reg_sf.set_nz(quint8(temp));
         reg_a = temp & 0x00FF;
     } else {
         // fetch data
         quint8 operand = p_ram->load(addr_abs);
         quint16 temp = quint16(operand << 1) | reg_sf.get_c();
         reg_sf.set_c(temp >= 0x100);
-        reg_sf.set_z((temp & 0x00FF) == 0);
-        reg_sf.set_n(temp & 0x80);
+        reg_sf.set_nz(quint8(temp));
         p_ram->save(addr_abs, temp & 0x00FF);
     }
     return 0;
@@ -745,16 +754,14 @@ int CPU::ROR()
         // IMP(Accumulator)
         quint16 temp = quint16(reg_a >> 1) | quint16(reg_sf.get_c() << 7); //
         reg_sf.set_c(reg_a & 0x0001);
-        reg_sf.set_z((temp & 0x00FF) == 0);
-        reg_sf.set_n(temp & 0x80);
+        reg_sf.set_nz(quint8(temp));
         reg_a = temp & 0x00FF;
     } else {
         // fetch data
         quint8 operand = p_ram->load(addr_abs);
         quint16 temp = quint16(operand >> 1) | quint16(reg_sf.get_c() << 7);
         reg_sf.set_c(operand & 0x0001);
-        reg_sf.set_z((temp & 0x00FF) == 0);
-        reg_sf.set_n(temp & 0x80);
+        reg_sf.set_nz(quint8(temp));
         p_ram->save(addr_abs, temp & 0x00FF);
     }
     return 0;
@@ -763,9 +770,8 @@ int CPU::ROR()
 int CPU::RTI()
 {
     // Return from interrupt
-    reg_sf.data = pull_stack();
+    reg_sf.set(pull_stack());
     reg_sf.set_b(false);
-    reg_sf.set_u(false);
     quint8 pc_lo8 = pull_stack();
     quint8 pc_hi8 = pull_stack();
     reg_pc = quint16(pc_hi8 << 8) + pc_lo8;
@@ -790,8 +796,7 @@ int CPU::SBC()
     quint16 sub = reg_a - operand - (!reg_sf.get_c());
     reg_sf.set_c(!(sub & 0x100));
     reg_sf.set_v((reg_a ^ sub) & ((~operand) ^ sub) & 0x80);
-    reg_sf.set_z((sub & 0xFF) == 0);
-    reg_sf.set_n(sub & 0x80);
+    reg_sf.set_nz(quint8(sub));
     reg_a = sub & 0x00FF;
     return 1;
 }
@@ -842,8 +847,7 @@ int CPU::TAX()
 {
     // Transfer A to X
     reg_x = reg_a;
-    reg_sf.set_z(reg_x == 0);
-    reg_sf.set_n(reg_x & 0x0080);
+    reg_sf.set_nz(reg_x);
     return 0;
 }
 
@@ -851,8 +855,7 @@ int CPU::TAY()
 {
     // Transfer A to Y
     reg_y = reg_a;
-    reg_sf.set_z(reg_y == 0);
-    reg_sf.set_n(reg_y & 0x0080);
+    reg_sf.set_nz(reg_y);
     return 0;
 }
 
@@ -860,8 +863,7 @@ int CPU::TSX()
 {
     // Transfer SP to X
     reg_x = reg_sp;
-    reg_sf.set_z(reg_x == 0);
-    reg_sf.set_n(reg_x & 0x0080);
+    reg_sf.set_nz(reg_x);
     return 0;
 }
 
@@ -869,8 +871,7 @@ int CPU::TXA()
 {
     // Transfer X to A
     reg_a = reg_x;
-    reg_sf.set_z(reg_a == 0);
-    reg_sf.set_n(reg_a & 0x0080);
+    reg_sf.set_nz(reg_a);
     return 0;
 }
 
@@ -885,18 +886,15 @@ int CPU::TYA()
 {
     // Transfer Y to A
     reg_a = reg_y;
-    reg_sf.set_z(reg_a == 0);
-    reg_sf.set_n(reg_a & 0x0080);
+    reg_sf.set_nz(reg_a);
     return 0;
 }
 
 int CPU::XXX()
 {
-    // Illegal Opcode
-    QMessageBox::critical(nullptr,
-                          QStringLiteral("ERROR"),
-                          QStringLiteral("CPU executed an unknown instruction! Exiting..."));
-    abort();
+    // Illegal Opcode: stop on it (all of them are implied, so PC is one past)
+    jammed = true;
+    reg_pc--;
     return 0;
 }
 
@@ -904,10 +902,31 @@ void CPU::clock()
 {
     // Only fetch another instruction after last one is done
     if (cycles_wait == 0) {
+        if (jammed)
+            return;
+#ifdef NES_TRACE
+        if (trace) {
+            TraceRecord r;
+            r.cycle = p_ram->cpu_time();
+            r.pc = reg_pc;
+            r.scanline = p_ram->Ppu.get_scanline();
+            r.dot = p_ram->Ppu.get_cycle();
+            r.opcode = p_ram->peek(reg_pc);
+            r.operand[0] = p_ram->peek(reg_pc + 1);
+            r.operand[1] = p_ram->peek(reg_pc + 2);
+            r.a = reg_a;
+            r.x = reg_x;
+            r.y = reg_y;
+            r.p = reg_sf.get();
+            r.sp = reg_sp;
+            trace->record(r);
+        }
+#endif
+        quint16 pc = reg_pc;
+
         // 1. fetch instruction
         opcode = p_ram->load(reg_pc);
         reg_pc++;
-        reg_sf.set_u(true);
         // 2. extra cycles
         int cycles_add_by_addrmode = (this->*inst_table[opcode].addrmode)();
         int cycles_add_by_operate = (this->*inst_table[opcode].operate)();
@@ -921,13 +940,52 @@ void CPU::clock()
             cycles_wait += (-cycles_add_by_operate);
         else
             cycles_wait += (cycles_add_by_operate & cycles_add_by_addrmode);
-        reg_sf.set_u(true);
+
+        watch_idle_loop(pc);
     }
 
     cycles_wait--;
     clock_count++;
 }
 
+// Called after each instruction with the address it started at. A short
+// backward branch or jump starts watching the code it goes back to, as long
+// as everything run there only reads; each pass that ends with the same
+// registers as the pass before adds its cycles to idle_cycles.
+void CPU::watch_idle_loop(quint16 pc)
+{
+    int kind = idle_kind[opcode];
+    bool closes = kind == IdleJump && reg_pc <= pc && pc - reg_pc <= idle_max_span;
+
+    if (idle_head >= 0) {
+        bool safe = kind != IdleUnsafe && pc >= idle_head && pc <= idle_tail;
+        // RAM, cartridge space and $2002 only; other registers change on their own
+        if (safe && kind == IdleRead)
+            safe = addr_abs < 0x2000 || addr_abs >= 0x6000
+                   || (addr_abs < 0x4000 && (addr_abs & 7) == 2);
+        if (safe) {
+            idle_pending += cycles_wait;
+            if (!closes || reg_pc != idle_head)
+                return;
+            quint32 regs = reg_a | reg_x << 8 | reg_y << 16 | quint32(reg_sf.get()) << 24;
+            if (idle_passed && regs == idle_regs)
+                idle_cycles += idle_pending;
+            idle_passed = true;
+            idle_regs = regs;
+            idle_pending = 0;
+            return;
+        }
+        idle_head = -1;
+    }
+
+    if (closes && reg_pc >= 0x6000) {
+        idle_head = reg_pc;
+        idle_tail = pc;
+        idle_passed = false;
+        idle_pending = 0;
+    }
+}
+
 void CPU::update_curr_instruction()
 {
     QString addr;
@@ -1007,38 +1065,75 @@ void CPU::print_log() const
              << int(reg_sf.get_i()) << int(reg_sf.get_z()) << int(reg_sf.get_c());
 }
 
-QDataStream &operator<<(QDataStream &stream, const CPU &Cpu)
-{
-    stream << Cpu.reg_a;
-    stream << Cpu.reg_x;
-    stream << Cpu.reg_y;
-    stream << Cpu.reg_pc;
-    stream << Cpu.reg_sp;
-    stream << Cpu.reg_sf.data;
-
-    stream << Cpu.addr_abs;
-    stream << Cpu.addr_rel;
-    stream << Cpu.cycles_wait;
-    stream << Cpu.opcode;
-    stream << Cpu.clock_count;
-
-    return stream;
-}
-
-QDataStream &operator>>(QDataStream &stream, CPU &Cpu)
-{
-    stream >> Cpu.reg_a;
-    stream >> Cpu.reg_x;
-    stream >> Cpu.reg_y;
-    stream >> Cpu.reg_pc;
-    stream >> Cpu.reg_sp;
-    stream >> Cpu.reg_sf.data;
-
-    stream >> Cpu.addr_abs;
-    stream >> Cpu.addr_rel;
-    stream >> Cpu.cycles_wait;
-    stream >> Cpu.opcode;
-    stream >> Cpu.clock_count;
+QString CPU::trace_line(const TraceRecord &r) const
+{
+    const Instruction &inst = inst_table[r.opcode];
+    quint16 word = quint16(r.operand[0] | r.operand[1] << 8);
+    char operand[16] = {0};
+    int length = 2;
+    if (inst.addrmode == &CPU::IMP) {
+        length = 1;
+    } else if (inst.addrmode == &CPU::IMM) {
+        sprintf(operand, "#$%02X", r.operand[0]);
+    } else if (inst.addrmode == &CPU::ZP0) {
+        sprintf(operand, "$%02X", r.operand[0]);
+    } else if (inst.addrmode == &CPU::ZPX) {
+        sprintf(operand, "$%02X,X", r.operand[0]);
+    } else if (inst.addrmode == &CPU::ZPY) {
+        sprintf(operand, "$%02X,Y", r.operand[0]);
+    } else if (inst.addrmode == &CPU::REL) {
+        sprintf(operand, "$%04X", quint16(r.pc + 2 + qint8(r.operand[0])));
+    } else if (inst.addrmode == &CPU::IZX) {
+        sprintf(operand, "($%02X,X)", r.operand[0]);
+    } else if (inst.addrmode == &CPU::IZY) {
+        sprintf(operand, "($%02X),Y", r.operand[0]);
+    } else {
+        length = 3;
+        if (inst.addrmode == &CPU::ABS)
+            sprintf(operand, "$%04X", word);
+        else if (inst.addrmode == &CPU::ABX)
+            sprintf(operand, "$%04X,X", word);
+        else if (inst.addrmode == &CPU::ABY)
+            sprintf(operand, "$%04X,Y", word);
+        else
+            sprintf(operand, "($%04X)", word);
+    }
 
-    return stream;
+    char bytes[12];
+    if (length == 1)
+        sprintf(bytes, "%02X      ", r.opcode);
+    else if (length == 2)
+        sprintf(bytes, "%02X %02X   ", r.opcode, r.operand[0]);
+    else
+        sprintf(bytes, "%02X %02X %02X", r.opcode, r.operand[0], r.operand[1]);
+
+    char line[128];
+    sprintf(line, "%04X  %s  %s %-27s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%llu",
+            r.pc, bytes, inst.name.toLatin1().constData(), operand, r.a, r.x, r.y, r.p, r.sp,
+            r.scanline, r.dot, (unsigned long long) r.cycle);
+    return QString(line);
+}
+
+void CPU::serialize(StateIO &io)
+{
+    io.begin_chunk(STATE_TAG('C', 'P', 'U', ' '));
+    io.pod(reg_a);
+    io.pod(reg_x);
+    io.pod(reg_y);
+    io.pod(reg_pc);
+    io.pod(reg_sp);
+    quint8 status = reg_sf.get();
+    io.pod(status);
+    reg_sf.set(status);
+
+    io.pod(addr_abs);
+    io.pod(addr_rel);
+    io.pod(cycles_wait);
+    io.pod(opcode);
+    io.pod(clock_count);
+    io.pod(jammed);
+    io.end_chunk();
+
+    if (io.is_loading())
+        forget_idle_loop();
 }
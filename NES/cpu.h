@@ -1,10 +1,11 @@
 #ifndef CPU_H
 #define CPU_H
 
-#include <QDataStream>
+#include "trace.h"
 #include <QString>
 
 class Bus; // forward declaration
+class StateIO;
 
 enum StatusFlag {
     C = (1 << 0), // Carry
@@ -18,34 +19,55 @@ enum StatusFlag {
 };
 
 // PSW
+// Most results set N and Z only to have the next instruction overwrite them,
+// so they are kept as the result byte they come from and C and V as bools.
+// The status byte is only put together when something needs all of it
+// (PHP, BRK, interrupts, savestates, the debugger).
 struct PSW
 {
 public:
-    PSW() { this->data = StatusFlag::U; }
-    void set_c(bool c) { c ? (data |= StatusFlag::C) : (data &= 0xfe); }
-    void set_z(bool z) { z ? (data |= StatusFlag::Z) : (data &= 0xfd); }
-    void set_i(bool i) { i ? (data |= StatusFlag::I) : (data &= 0xfb); }
-    void set_d(bool d) { d ? (data |= StatusFlag::D) : (data &= 0xf7); }
-    void set_b(bool b) { b ? (data |= StatusFlag::B) : (data &= 0xef); }
-    void set_u(bool u) { u ? (data |= StatusFlag::U) : (data &= 0xdf); }
-    void set_v(bool v) { v ? (data |= StatusFlag::V) : (data &= 0xbf); }
-    void set_n(bool n) { n ? (data |= StatusFlag::N) : (data &= 0x7f); }
-    bool get_c() const { return (data & StatusFlag::C) ? 1 : 0; }
-    bool get_z() const { return (data & StatusFlag::Z) ? 1 : 0; }
-    bool get_i() const { return (data & StatusFlag::I) ? 1 : 0; }
-    bool get_d() const { return (data & StatusFlag::D) ? 1 : 0; }
-    bool get_b() const { return (data & StatusFlag::B) ? 1 : 0; }
-    bool get_v() const { return (data & StatusFlag::V) ? 1 : 0; }
-    bool get_n() const { return (data & StatusFlag::N) ? 1 : 0; }
+    PSW() { set(StatusFlag::U); }
+    void set_c(bool c) { carry = c; }
+    void set_z(bool z) { zero_result = !z; }
+    void set_i(bool i) { i ? (flags |= StatusFlag::I) : (flags &= 0xfb); }
+    void set_d(bool d) { d ? (flags |= StatusFlag::D) : (flags &= 0xf7); }
+    void set_b(bool b) { b ? (flags |= StatusFlag::B) : (flags &= 0xef); }
+    void set_v(bool v) { overflow = v; }
+    void set_n(bool n) { sign_result = n ? 0x80 : 0; }
+    void set_nz(quint8 result) { sign_result = zero_result = result; }
+    bool get_c() const { return carry; }
+    bool get_z() const { return zero_result == 0; }
+    bool get_i() const { return (flags & StatusFlag::I) ? 1 : 0; }
+    bool get_d() const { return (flags & StatusFlag::D) ? 1 : 0; }
+    bool get_b() const { return (flags & StatusFlag::B) ? 1 : 0; }
+    bool get_v() const { return overflow; }
+    bool get_n() const { return sign_result & 0x80; }
 
-public:
-    quint8 data;
+    // the whole status byte; U always reads as 1
+    quint8 get() const
+    {
+        return flags | StatusFlag::U | (sign_result & StatusFlag::N) | (overflow ? StatusFlag::V : 0)
+               | (zero_result ? 0 : StatusFlag::Z) | (carry ? StatusFlag::C : 0);
+    }
+    void set(quint8 data)
+    {
+        flags = data & (StatusFlag::I | StatusFlag::D | StatusFlag::B);
+        sign_result = data & StatusFlag::N;
+        overflow = data & StatusFlag::V;
+        zero_result = !(data & StatusFlag::Z);
+        carry = data & StatusFlag::C;
+    }
+
+private:
+    quint8 flags;       // I, D and B
+    quint8 sign_result; // N is its bit 7
+    quint8 zero_result; // Z is set if it's 0
+    bool carry;
+    bool overflow;
 };
 
 class CPU
 {
-    friend QDataStream &operator<<(QDataStream &stream, const CPU &Cpu); // Serialize
-    friend QDataStream &operator>>(QDataStream &stream, CPU &Cpu);       // Deserialize
 public:
     quint8 reg_a;   // Accumulator Register
     quint8 reg_x;   // X Register
@@ -54,6 +76,11 @@ public:
     quint8 reg_sp;  // Stack Pointer
     PSW reg_sf;      // Status Register
 
+    // Stopped on an opcode this CPU doesn't run, with PC left on it, as the
+    // 6502's KIL opcodes stop it: no more instructions or interrupts until a
+    // reset. Whoever runs the console decides what to do about it.
+    bool jammed = false;
+
     // ASM instructions
 private:
     // 56 Opcodes
@@ -273,6 +300,7 @@ public:
     CPU(Bus * = nullptr);
     void connectToBus(Bus *);
     void reset();                   // Reset
+    void soft_reset();              // the reset button: A, X, Y kept, SP down by 3
     void irq();                     // Interrupt Request
     void nmi();                     // Non-Maskable Interrupt
     void push_stack(quint8 value);
@@ -280,6 +308,23 @@ public:
     void clock(); // run 1 cycle
     void print_log() const;
     void update_curr_instruction(); // this is for debugger
+    void serialize(StateIO &io);    // save/load state
+    bool is_documented(quint8 op) const { return inst_table[op].operate != &CPU::XXX; }
+    // CPU cycles from the start of the current instruction to its last, where
+    // the 6502 reads or writes the operand. The whole instruction runs on the
+    // first, so registers that change with time are read and written this late.
+    int access_delay() const { return inst_table[opcode].cycle_cnt - 1; }
+
+    // CPU cycles spent in wait loops (LDA $2002 / BPL, LDA zp / BEQ ...) since
+    // reset: short backward loops in cartridge space that only read RAM, ROM or
+    // $2002, counted from their second pass that leaves the registers as the
+    // one before did. A profile of how much a game idles; nothing is skipped.
+    quint64 idle_cycles = 0;
+
+    // Instructions are recorded here when set, in builds with NES_TRACE defined
+    TraceRing *trace = nullptr;
+    // nestest.log style line for a recorded instruction
+    QString trace_line(const TraceRecord &r) const;
 
     quint16 addr_abs; // absolute address
     quint16 addr_rel; // relative address
@@ -293,6 +338,20 @@ public:
     quint16 oprand_for_log;   // data used by current instruction
     quint8 address_mode;      // address mode of current instruction
     QString curr_instruction; // current instruction, example: LDA 2002H
+
+private:
+    enum { idle_max_span = 32 }; // bytes from a wait loop's start to its branch
+    enum IdleKind { IdleUnsafe, IdleSafe, IdleRead, IdleJump };
+
+    quint8 idle_kind[256];      // IdleKind of each opcode
+    int idle_head = -1;         // first address of the loop being watched, -1 if none
+    quint16 idle_tail = 0;      // address of the branch closing it
+    bool idle_passed = false;   // a whole pass has been seen, leaving idle_regs
+    quint32 idle_regs = 0;      // A, X, Y and P after that pass
+    quint32 idle_pending = 0;   // cycles of the pass being watched
+
+    void forget_idle_loop() { idle_head = -1; }
+    void watch_idle_loop(quint16 pc);
 };
 
 #endif // CPU_H
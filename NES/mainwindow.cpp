@@ -10,16 +10,13 @@
 
 Bus Nes; // Global Variable Nes
 
-static int read_dmc(void *, cpu_addr_t addr)
-{
-    return Nes.load(addr);
-}
-
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWindow)
 {
     WindowInit();
     InitAudio();
     OpenSound = false;
+    rewinding = false;
+    frame_count = 0;
 
     ui->setupUi(this);
     this->setFocusPolicy(Qt::StrongFocus);
@@ -27,9 +24,6 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     ui->graphicsView->setFocusPolicy(Qt::NoFocus);
     ui->graphicsView->setScene(scene_game);
 
-    // Bind dmc_reader
-    Nes.Apu.dmc_reader(read_dmc, NULL);
-
     connect(ui->actionExit, &QAction::triggered, this, &MainWindow::close);
     connect(ui->ActionChooseFile, &QAction::triggered, this, &MainWindow::OnChooseFile);
     connect(ui->actionOpenDebugger, &QAction::triggered, this, [=]() {
@@ -41,6 +35,12 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWi
     connect(ui->actionSave, &QAction::triggered, this, &MainWindow::SaveGame);
     connect(ui->actionLoad, &QAction::triggered, this, &MainWindow::LoadGame);
     connect(ui->actionReload, &QAction::triggered, this, &MainWindow::ReloadGame);
+    connect(ui->actionRunAhead, &QAction::triggered, this, &MainWindow::ToggleRunAhead);
+    connect(ui->actionRunAheadInstance, &QAction::triggered, this, &MainWindow::ToggleRunAheadInstance);
+    connect(ui->actionRecordMovie, &QAction::triggered, this, &MainWindow::ToggleMovieRecording);
+    connect(ui->actionPlayMovie, &QAction::triggered, this, &MainWindow::PlayMovie);
+
+    run_ahead.set_movie(&movie);
 
     ToggleSound(); // Turn on sound by default
 }
@@ -118,13 +118,20 @@ void MainWindow::OnChooseFile()
             timer_game = NULL;  
         }
         scene_game->clear();
+        StopMovie();
 
         Nes.cartridge.reset();
-        if (Nes.cartridge.read_from_file(filename)) {
+        QString error;
+        if (Nes.cartridge.read_from_file(filename, &error)) {
             Nes.reset();
+            rewind_buffer.clear();
+            if (run_ahead.second_instance())
+                run_ahead.set_second_instance(file_path);
             FCInit();
-        } else
+        } else {
             file_path = "";
+            QMessageBox::critical(this, QStringLiteral("ERROR"), error);
+        }
     } else if (filename == "") {
         return;
     } else {
@@ -141,38 +148,62 @@ void MainWindow::ReloadGame()
             timer_game = NULL;
         }
         scene_game->clear();
+        StopMovie();
 
         Nes.cartridge.reset();
-        if (Nes.cartridge.read_from_file(file_path)) {
+        QString error;
+        if (Nes.cartridge.read_from_file(file_path, &error)) {
             Nes.reset();
+            rewind_buffer.clear();
+            if (run_ahead.second_instance())
+                run_ahead.set_second_instance(file_path);
             FCInit();
-        } else
+        } else {
             file_path = "";
+            QMessageBox::critical(this, QStringLiteral("ERROR"), error);
+        }
     }
 }
 
 void MainWindow::OnNewFrame()
 {
-    do {
-        Nes.clock();
-    } while (!Nes.Ppu.frame_complete);
-    Nes.Ppu.frame_complete = false;
-
-    // Call the apu per frame
-    Nes.Apu.end_frame();
-    if(OpenSound) {
-        Nes.Apu.out_count = Nes.Apu.read_samples(Nes.Apu.out_buf, BUFFER_SIZE);
+    // While rewinding, step back one snapshot and run a frame from it to get a picture
+    bool rewound = rewinding && rewind_buffer.rewind(Nes, 1) > 0;
+
+    // Run-ahead may show the picture of a frame further on, from another console
+    const Bus *shown = &Nes;
+    if (rewound)
+        Nes.run_frame();
+    else
+        shown = &run_ahead.run_frame(Nes);
+
+    // Always drain the samples so the buffer can't fill up
+    Nes.Apu.out_count = Nes.Apu.read_samples(Nes.Apu.out_buf, BUFFER_SIZE);
+    if (OpenSound && !rewound) {
         char *buf_ptr = (char *) Nes.Apu.out_buf;
         qAudioDevice->write(buf_ptr, Nes.Apu.out_count * 2);
     }
 
+    if (!rewound)
+        rewind_buffer.capture(Nes);
+
+    if (movie.finished()) {
+        StopMovie();
+        ui->statusBar->showMessage("Movie finished", 3000);
+    }
+
+    if (run_ahead.frames() && ++frame_count % 30 == 0)
+        ui->statusBar->showMessage(QString("Run-ahead %1 frames: +%2 ms/frame")
+                                       .arg(run_ahead.frames())
+                                       .arg(run_ahead.overhead_ms(), 0, 'f', 2));
+
     scene_game->clear();
 
-    for (int x = 0; x < 256; x++) {
-        for (int y = 0; y < 240; y++) {
-            pixels[y * 256 + x] = qRgb(Nes.Ppu.frame_data[x][y][0],
-                                       Nes.Ppu.frame_data[x][y][1],
-                                       Nes.Ppu.frame_data[x][y][2]);
+    for (int y = 0; y < 240; y++) {
+        for (int x = 0; x < 256; x++) {
+            pixels[y * 256 + x] = qRgb(shown->Ppu.frame_data[y][x][0],
+                                       shown->Ppu.frame_data[y][x][1],
+                                       shown->Ppu.frame_data[y][x][2]);
         }
     }
     QImage img((uchar *) pixels, 256, 240, QImage::Format_ARGB32);
@@ -182,6 +213,19 @@ void MainWindow::OnNewFrame()
     pixmap_lp->setPixmap(img_pixmap.scaled(512, 480, Qt::KeepAspectRatio));
     pixmap_lp->setPos(QPointF(0, 0));
     scene_game->addItem(pixmap_lp);
+
+    // The console has stopped for good; keep its last picture up until the
+    // game is reloaded
+    if (Nes.Cpu.jammed) {
+        timer_game->stop();
+        timer_game->deleteLater();
+        timer_game = NULL;
+        QMessageBox::critical(this,
+                              QStringLiteral("ERROR"),
+                              QStringLiteral("CPU executed an unknown instruction (%1H at %2H)")
+                                  .arg(Nes.Cpu.opcode, 2, 16, QLatin1Char('0'))
+                                  .arg(Nes.Cpu.reg_pc, 4, 16, QLatin1Char('0')));
+    }
 }
 
 void MainWindow::ToggleSound()
@@ -195,6 +239,31 @@ void MainWindow::ToggleSound()
     }
 }
 
+// Cycle run-ahead through off, 1, 2 and 3 frames
+void MainWindow::ToggleRunAhead()
+{
+    int n = (run_ahead.frames() + 1) % 4;
+    run_ahead.set_frames(n);
+    if (n)
+        ui->actionRunAhead->setText(QString("RunAhead: %1").arg(n));
+    else {
+        ui->actionRunAhead->setText("RunAhead: Off");
+        ui->statusBar->clearMessage();
+    }
+}
+
+// Switch between rolling back the console and running ahead on a second one
+void MainWindow::ToggleRunAheadInstance()
+{
+    if (!run_ahead.second_instance() && file_path != "") {
+        if (run_ahead.set_second_instance(file_path))
+            ui->actionRunAheadInstance->setText("RunAhead: SecondInstance");
+    } else {
+        run_ahead.set_second_instance(QString());
+        ui->actionRunAheadInstance->setText("RunAhead: SameInstance");
+    }
+}
+
 // This function could create multiple directories at once
 QString mkMutiDir(const QString path)
 {
@@ -217,9 +286,10 @@ void MainWindow::SaveGame()
 
         QFile file("./save/" + Nes.cartridge.game_title + "/"
                    + QDateTime::currentDateTime().toString("yyyyMMddhhmmss") + ".sav");
+        QByteArray state;
+        Nes.save_state(state);
         file.open(QFile::WriteOnly);
-        QDataStream output(&file);
-        output << Nes;
+        file.write(state);
         file.close();
     }
 }
@@ -231,9 +301,12 @@ void MainWindow::LoadGame()
         if (filename.toLower().endsWith(".sav")) {
             QFile file(filename);
             file.open(QIODevice::ReadOnly);
-            QDataStream input(&file);
-            input >> Nes;
+            QByteArray state = file.readAll();
             file.close();
+            if (!Nes.load_state(state))
+                QMessageBox::critical(this,
+                                      QStringLiteral("ERROR"),
+                                      QStringLiteral("Savefile isn't compatible with current game!"));
         } else if (filename == "")
             return;
         else {
@@ -242,10 +315,61 @@ void MainWindow::LoadGame()
     }
 }
 
+// Record from the current state; stopping saves the movie next to the savefiles
+void MainWindow::ToggleMovieRecording()
+{
+    if (movie.mode() == Movie::Recording)
+        StopMovie();
+    else if (file_path != "") {
+        StopMovie();
+        movie.record(Nes, false);
+        ui->actionRecordMovie->setText("StopRecording");
+    }
+}
+
+void MainWindow::PlayMovie()
+{
+    if (file_path == "")
+        return;
+    QString filename = QFileDialog::getOpenFileName(this, "ChooseFile", "./movie/");
+    if (filename == "")
+        return;
+    StopMovie();
+    if (!movie.load(filename)) {
+        QMessageBox::warning(this, QStringLiteral("Warnings"), QStringLiteral("Invalid File"));
+        return;
+    }
+    if (movie.from_power_on())
+        ReloadGame();
+    if (!movie.play(Nes)) {
+        QMessageBox::critical(this,
+                              QStringLiteral("ERROR"),
+                              QStringLiteral("Movie isn't compatible with current game!"));
+        return;
+    }
+    rewind_buffer.clear();
+    ui->statusBar->showMessage(QString("Playing movie: %1 frames").arg(movie.length()), 3000);
+}
+
+void MainWindow::StopMovie()
+{
+    if (movie.mode() == Movie::Recording) {
+        movie.stop();
+        mkMutiDir("./movie/" + Nes.cartridge.game_title);
+        if (movie.save("./movie/" + Nes.cartridge.game_title + "/"
+                       + QDateTime::currentDateTime().toString("yyyyMMddhhmmss") + ".nesm"))
+            ui->statusBar->showMessage(QString("Movie saved: %1 frames").arg(movie.length()), 3000);
+        ui->actionRecordMovie->setText("RecordMovie");
+    }
+    movie.stop();
+}
+
 void MainWindow::keyPressEvent(QKeyEvent *event)
 {
     int key = event->key();
-    if (Nes.controller_left.key_map.find(key) != Nes.controller_left.key_map.end()) {
+    if (key == Qt::Key_Backspace) {
+        rewinding = true; // hold to rewind
+    } else if (Nes.controller_left.key_map.find(key) != Nes.controller_left.key_map.end()) {
         Nes.controller_left.cur_keystate[Nes.controller_left.key_map[key]] = true;
     } else if (Nes.controller_right.key_map.find(key) != Nes.controller_right.key_map.end()) {
         Nes.controller_right.cur_keystate[Nes.controller_right.key_map[key]] = true;
@@ -255,7 +379,10 @@ void MainWindow::keyPressEvent(QKeyEvent *event)
 void MainWindow::keyReleaseEvent(QKeyEvent *event)
 {
     int key = event->key();
-    if (Nes.controller_left.key_map.find(key) != Nes.controller_left.key_map.end()) {
+    if (key == Qt::Key_Backspace) {
+        if (!event->isAutoRepeat())
+            rewinding = false;
+    } else if (Nes.controller_left.key_map.find(key) != Nes.controller_left.key_map.end()) {
         Nes.controller_left.cur_keystate[Nes.controller_left.key_map[key]] = false;
     } else if (Nes.controller_right.key_map.find(key) != Nes.controller_right.key_map.end()) {
         Nes.controller_right.cur_keystate[Nes.controller_right.key_map[key]] = false;
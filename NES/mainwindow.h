@@ -1,6 +1,9 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include "movie.h"
+#include "rewind.h"
+#include "runahead.h"
 #include <QAudioOutput>
 #include <QGraphicsPixmapItem>
 #include <QGraphicsScene>
@@ -33,6 +36,11 @@ public slots:
     void SaveGame();
     void LoadGame();
     void ReloadGame();
+    void ToggleRunAhead();
+    void ToggleRunAheadInstance();
+    void ToggleMovieRecording();
+    void PlayMovie();
+    void StopMovie();
 
 protected:
     void keyPressEvent(QKeyEvent *event);
@@ -48,6 +56,11 @@ private:
     QString file_path;
     int frame_interval;
     bool OpenSound;
+    RewindBuffer rewind_buffer;
+    bool rewinding; // rewind key held
+    RunAhead run_ahead;
+    int frame_count;
+    Movie movie;
 
 private:
     Ui::MainWindow *ui;
@@ -0,0 +1,312 @@
+#include "movie.h"
+#include "bus.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFile>
+#include <cstring>
+
+static const char movie_magic[4] = {'N', 'E', 'S', 'M'};
+static const int header_size = 52;
+static const char index_magic[4] = {'N', 'E', 'S', 'I'};
+static const int index_header_size = 32;
+static const quint32 index_version = 1;
+
+Movie::Movie()
+    : current_mode(Idle), bus(nullptr), start_frame(0), frame_count(0), interval(600)
+{}
+
+Movie::~Movie()
+{
+    detach();
+}
+
+void Movie::attach(Bus &console)
+{
+    detach();
+    bus = &console;
+    start_frame = console.frame_number();
+    console.controller_left.set_latch_hook(latch, this, 0);
+    console.controller_right.set_latch_hook(latch, this, 1);
+}
+
+void Movie::detach()
+{
+    if (bus) {
+        bus->controller_left.set_latch_hook(nullptr, nullptr, 0);
+        bus->controller_right.set_latch_hook(nullptr, nullptr, 1);
+    }
+    bus = nullptr;
+}
+
+int Movie::frame() const
+{
+    return bus ? int(bus->frame_number() - start_frame) : 0;
+}
+
+void Movie::record(Bus &console, bool from_power_on)
+{
+    stop();
+    if (from_power_on) {
+        console.power_on();
+        start_state.clear();
+    } else {
+        console.save_state(start_state);
+    }
+    md5 = console.cartridge.md5_val;
+    inputs.clear();
+    frame_count = 0;
+    index.clear();
+    attach(console);
+    current_mode = Recording;
+}
+
+bool Movie::play(Bus &console)
+{
+    stop();
+    if (md5 != console.cartridge.md5_val) {
+        qDebug() << "Movie was recorded with another game";
+        return false;
+    }
+    if (!restart(console))
+        return false;
+
+    attach(console);
+    current_mode = Playing;
+    frame_done(); // index the start too
+    return true;
+}
+
+// Put the console back where the movie starts
+bool Movie::restart(Bus &console)
+{
+    if (!start_state.isEmpty())
+        return console.load_state(start_state);
+    console.power_on();
+    return true;
+}
+
+void Movie::stop()
+{
+    if (current_mode == Recording) {
+        frame_count = qMax(frame(), 0);
+        inputs.resize(frame_count * ports);
+    }
+    detach();
+    current_mode = Idle;
+}
+
+void Movie::set_index_interval(int frames)
+{
+    interval = qMax(frames, 0);
+    index.clear();
+}
+
+void Movie::frame_done()
+{
+    int f = frame();
+    if (current_mode != Playing || interval == 0 || f < 0 || f % interval != 0 || f > frame_count)
+        return;
+    size_t slot = f / interval;
+    if (slot >= index.size())
+        index.resize(slot + 1);
+    if (index[slot].isEmpty())
+        bus->save_state(index[slot]);
+}
+
+bool Movie::seek(int target)
+{
+    if (current_mode != Playing)
+        return false;
+    target = qBound(0, target, frame_count);
+
+    // the closest state strictly before 'target', so the picture gets drawn
+    int slot = -1;
+    if (interval && target > 0)
+        slot = qMin(int((target - 1) / interval), int(index.size()) - 1);
+    while (slot >= 0 && index[slot].isEmpty())
+        slot--;
+
+    bool loaded = slot >= 0 ? bus->load_state(index[slot]) : restart(*bus);
+    if (!loaded)
+        return false;
+
+    bool was_suppressed = bus->Apu.output_suppressed();
+    bus->Apu.suppress_output(true);
+    while (frame() < target) {
+        bus->Ppu.video_output = (frame() == target - 1);
+        bus->run_frame();
+        frame_done();
+    }
+    bus->Ppu.video_output = true;
+    bus->Apu.suppress_output(was_suppressed);
+    return true;
+}
+
+// Ties an index to the movie it was built from
+QByteArray Movie::movie_id() const
+{
+    return QCryptographicHash::hash(to_bytes(), QCryptographicHash::Md5);
+}
+
+// Index file layout (little-endian): "NESI", quint32 version, quint32 interval,
+// quint32 slot count, 16 byte MD5 of the movie file, then for each slot a quint32
+// size and the savestate (size 0 if that frame wasn't reached).
+bool Movie::save_index(const QString &path) const
+{
+    QByteArray data(index_header_size, '\0');
+    char *p = data.data();
+    quint32 value;
+    memcpy(p, index_magic, 4);
+    memcpy(p + 4, &index_version, 4);
+    value = interval;
+    memcpy(p + 8, &value, 4);
+    value = quint32(index.size());
+    memcpy(p + 12, &value, 4);
+    QByteArray id = movie_id();
+    memcpy(p + 16, id.constData(), 16);
+
+    for (const QByteArray &state : index) {
+        value = state.size();
+        data.append((const char *) &value, 4);
+        data.append(state);
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    return file.write(data) == data.size();
+}
+
+bool Movie::load_index(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = file.readAll();
+    const char *p = data.constData();
+    if (data.size() < index_header_size || memcmp(p, index_magic, 4) != 0)
+        return false;
+
+    quint32 file_version, file_interval, slot_count;
+    memcpy(&file_version, p + 4, 4);
+    memcpy(&file_interval, p + 8, 4);
+    memcpy(&slot_count, p + 12, 4);
+    if (file_version != index_version || file_interval == 0
+        || memcmp(p + 16, movie_id().constData(), 16) != 0) {
+        qDebug() << "Index was built for another movie";
+        return false;
+    }
+
+    std::vector<QByteArray> states;
+    int pos = index_header_size;
+    for (quint32 i = 0; i < slot_count; i++) {
+        quint32 size;
+        if (pos + 4 > data.size())
+            return false;
+        memcpy(&size, p + pos, 4);
+        pos += 4;
+        if (size > quint32(data.size() - pos))
+            return false;
+        states.push_back(data.mid(pos, int(size)));
+        pos += int(size);
+    }
+
+    interval = int(file_interval);
+    index.swap(states);
+    return true;
+}
+
+quint8 Movie::buttons(quint32 frame_number, int port, quint8 live) const
+{
+    int index = int(frame_number - start_frame);
+    if (current_mode != Playing || index < 0 || index >= frame_count)
+        return live;
+    return quint8(inputs[index * ports + port]);
+}
+
+// Called by the controllers each time the game latches the buttons
+quint8 Movie::latch(void *user_data, int port, quint8 buttons)
+{
+    Movie *movie = static_cast<Movie *>(user_data);
+    int index = movie->frame();
+    if (index < 0)
+        return buttons;
+
+    if (movie->current_mode == Recording) {
+        int needed = (index + 1) * ports;
+        if (movie->inputs.size() < needed) {
+            int old_size = movie->inputs.size();
+            movie->inputs.resize(needed);
+            memset(movie->inputs.data() + old_size, 0, needed - old_size);
+        }
+        movie->inputs[index * ports + port] = char(buttons);
+        return buttons;
+    }
+
+    return movie->buttons(movie->bus->frame_number(), port, buttons);
+}
+
+QByteArray Movie::to_bytes() const
+{
+    QByteArray data(header_size, '\0');
+    char *p = data.data();
+    quint32 value;
+    memcpy(p, movie_magic, 4);
+    value = version;
+    memcpy(p + 4, &value, 4);
+    value = frame_count;
+    memcpy(p + 8, &value, 4);
+    p[12] = ports;
+    p[13] = start_state.isEmpty() ? 0 : 1;
+    memcpy(p + 16, md5.constData(), qMin(md5.size(), 32));
+    value = start_state.size();
+    memcpy(p + 48, &value, 4);
+
+    data.append(start_state);
+    data.append(inputs.constData(), frame_count * ports);
+    return data;
+}
+
+bool Movie::from_bytes(const QByteArray &data)
+{
+    stop();
+    const char *p = data.constData();
+    if (data.size() < header_size || memcmp(p, movie_magic, 4) != 0) {
+        qDebug() << "Not a movie file";
+        return false;
+    }
+
+    quint32 file_version, frames, state_size;
+    memcpy(&file_version, p + 4, 4);
+    memcpy(&frames, p + 8, 4);
+    memcpy(&state_size, p + 48, 4);
+    if (file_version != version || quint8(p[12]) != ports
+        || quint64(data.size()) != header_size + quint64(state_size) + quint64(frames) * ports) {
+        qDebug() << "Unsupported or damaged movie file";
+        return false;
+    }
+
+    md5 = QByteArray(p + 16, 32);
+    start_state = data.mid(header_size, int(state_size));
+    inputs = data.mid(header_size + int(state_size));
+    frame_count = int(frames);
+    index.clear();
+    return true;
+}
+
+bool Movie::save(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QByteArray data = to_bytes();
+    return file.write(data) == data.size();
+}
+
+bool Movie::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    return from_bytes(file.readAll());
+}
@@ -0,0 +1,91 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+#include <vector>
+
+class Bus;
+
+// Input movie: the buttons each controller latched on every frame, so a run
+// can be replayed exactly.
+//
+// File layout (little-endian):
+//   "NESM", quint32 version, quint32 frame count, quint8 ports, quint8 flags,
+//   quint16 reserved, 32 byte ROM MD5 (hex), quint32 state size, the starting
+//   savestate (if flags & 1, otherwise the movie starts at power-on), then one
+//   byte per controller per frame (bit n = FC_KEY n).
+class Movie
+{
+public:
+    enum Mode { Idle, Recording, Playing };
+
+    Movie();
+    ~Movie();
+
+    // Start recording on 'bus'. From power-on the console and cartridge are
+    // powered on (Bus::power_on); otherwise the current state is stored.
+    void record(Bus &bus, bool from_power_on);
+
+    // Play the movie on 'bus' from its start. Fails if it's for another game.
+    // After the last frame the live buttons are used again.
+    bool play(Bus &bus);
+
+    // Stop recording or playing. A recording ends at the current frame.
+    void stop();
+
+    Mode mode() const { return current_mode; }
+    bool from_power_on() const { return start_state.isEmpty(); }
+    int frame() const; // frames since the movie started
+    int length() const { return frame_count; }
+    bool finished() const { return current_mode == Playing && frame() >= frame_count; }
+
+    // The buttons a playing movie gives 'port' on the console's frame
+    // 'frame_number' (as Bus::frame_number counts), or 'live' when it has
+    // none for that frame. For consoles running the movie ahead (RunAhead).
+    quint8 buttons(quint32 frame_number, int port, quint8 live) const;
+
+    // While playing, a savestate is kept every 'frames' frames (0 for none)
+    // so seek() never replays more than that. Call frame_done() after each
+    // frame the console runs to fill the index.
+    void set_index_interval(int frames);
+    int index_interval() const { return interval; }
+    void frame_done();
+
+    // Jump to 'frame' of the movie being played: restore the closest indexed
+    // state before it, then replay silently up to it, drawing the last frame.
+    bool seek(int frame);
+
+    // The index can be kept next to the movie so it's there the next time.
+    // Loading fails if it was built for another movie.
+    bool save_index(const QString &path) const;
+    bool load_index(const QString &path);
+
+    QByteArray to_bytes() const;
+    bool from_bytes(const QByteArray &data);
+    bool save(const QString &path) const;
+    bool load(const QString &path);
+
+private:
+    enum { ports = 2, version = 1 };
+
+    Mode current_mode;
+    Bus *bus;
+    quint32 start_frame;
+    QByteArray md5;
+    QByteArray start_state;
+    QByteArray inputs; // frame_count * ports bytes, more while recording
+    int frame_count;
+
+    int interval;
+    std::vector<QByteArray> index; // index[i] is the state at frame i * interval, if taken
+
+    void attach(Bus &console);
+    bool restart(Bus &console);
+    QByteArray movie_id() const;
+    void detach();
+    static quint8 latch(void *user_data, int port, quint8 buttons);
+};
+
+#endif // MOVIE_H
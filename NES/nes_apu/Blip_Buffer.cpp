@@ -3,7 +3,7 @@
 #include "Blip_Buffer.h"
 
 #include <math.h>
-#include <new.h>
+#include <new>
 #include <string.h>
 
 /* Copyright (C) 2003-2005 Shay Green. This module is free software; you
@@ -32,6 +32,18 @@ Blip_Buffer::Blip_Buffer()
 	length_ = 0;
 
 	bass_freq_ = 16;
+
+	kernels_ = blip_kernels();
+}
+
+void Blip_Buffer::simd_level(int level)
+{
+	kernels_ = blip_kernels(level);
+}
+
+int Blip_Buffer::simd_level() const
+{
+	return kernels_->level;
 }
 
 void Blip_Buffer::clear(bool entire_buffer)
@@ -44,7 +56,8 @@ void Blip_Buffer::clear(bool entire_buffer)
 
 blargg_err_t Blip_Buffer::sample_rate(long new_rate, int msec)
 {
-	unsigned new_size = (ULONG_MAX >> BLIP_BUFFER_ACCURACY) + 1 - widest_impulse_ - 64;
+	// same limit as with a 32-bit long (about 65000 samples), wherever long is wider
+	unsigned new_size = (0xFFFFFFFFul >> BLIP_BUFFER_ACCURACY) + 1 - widest_impulse_ - 64;
 	if (msec != blip_default_length)
 	{
 		size_t s = (new_rate * (msec + 1) + 999) / 1000;
@@ -344,38 +357,8 @@ long Blip_Buffer::read_samples(blip_sample_t* out, long max_samples, bool stereo
 	if (!count)
 		return 0; // optimization
 
-	int sample_offset = this->sample_offset;
-	int bass_shift = this->bass_shift;
-	buf_t_* buf = buffer_;
-	long accum = reader_accum;
-
-	if (!stereo) {
-		for (long n = count; n--; ) {
-			long s = accum >> accum_fract;
-			accum -= accum >> bass_shift;
-			accum += (long(*buf++) - sample_offset) << accum_fract;
-			*out++ = (blip_sample_t)s;
-
-			// clamp sample
-			if ((BOOST::int16_t)s != s)
-				out[-1] = blip_sample_t(0x7FFF - (s >> 24));
-		}
-	}
-	else {
-		for (long n = count; n--; ) {
-			long s = accum >> accum_fract;
-			accum -= accum >> bass_shift;
-			accum += (long(*buf++) - sample_offset) << accum_fract;
-			*out = (blip_sample_t)s;
-			out += 2;
-
-			// clamp sample
-			if ((BOOST::int16_t)s != s)
-				out[-2] = blip_sample_t(0x7FFF - (s >> 24));
-		}
-	}
-
-	reader_accum = accum;
+	reader_accum = kernels_->read_samples(buffer_, out, count, stereo ? 2 : 1,
+			reader_accum, bass_shift);
 
 	remove_samples(count);
 
@@ -10,6 +10,7 @@
 #include "blargg_common.h"
 
 class Blip_Reader;
+struct blip_kernels_t;
 
 // Source time unit.
 typedef long blip_time_t;
@@ -75,6 +76,11 @@ public:
 	// Number of samples delay from synthesis to samples read out
 	int output_latency() const;
 	
+	// Restrict SIMD kernels to specified level (see Blip_Simd.h). Output is the
+	// same at every level; this is for benchmarking and testing.
+	void simd_level( int level );
+	int simd_level() const;
+	
 	
 	// Experimental external buffer mixing support
 	
@@ -113,6 +119,7 @@ private:
 		resampled_time_t offset_;
 		buf_t_* buffer_;
 		unsigned buffer_size_;
+		const blip_kernels_t* kernels_;
 	private:
 		long reader_accum;
 		int bass_shift;
@@ -247,6 +254,7 @@ inline long Blip_Buffer::clock_rate() const {
 // MSVC6 fix
 typedef Blip_Buffer::resampled_time_t blip_resampled_time_t;
 
+#include "Blip_Simd.h"
 #include "Blip_Synth.h"
 
 #endif
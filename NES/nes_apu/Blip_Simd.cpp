@@ -0,0 +1,429 @@
+
+// Blip_Buffer 0.3.3. http://www.slack.net/~ant/libs/
+
+#include "Blip_Simd.h"
+
+#include <string.h>
+
+/* Copyright (C) 2003-2005 Shay Green. This module is free software; you
+can redistribute it and/or modify it under the terms of the GNU Lesser
+General Public License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version. This
+module is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for
+more details. You should have received a copy of the GNU Lesser General
+Public License along with this module; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA */
+
+#include BLARGG_SOURCE_BEGIN
+
+#if defined (__x86_64__) || defined (_M_X64) || defined (__SSE2__) || \
+		(defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define BLIP_SIMD_X86 1
+	#include <emmintrin.h>
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+#else
+	#define BLIP_SIMD_X86 0
+#endif
+
+#if BLIP_SIMD_X86 && (defined (__GNUC__) || defined (__clang__))
+	#define BLIP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define BLIP_TARGET_AVX2
+#endif
+
+typedef BOOST::uint32_t pair_t;
+typedef BOOST::int32_t  int32_t_;
+
+// Same as Blip_Buffer::accum_fract and Blip_Buffer::sample_offset
+enum { accum_fract = 15 };
+enum { sample_offset = 0x7F7F };
+
+// Samples are integrated in blocks of this size so SIMD conversion and
+// clamping can run on either side of the serial integrator
+enum { block_size = 64 };
+
+// Scalar
+
+static long read_samples_scalar( const BOOST::uint16_t* buf, BOOST::int16_t* out, long count,
+		int stride, long accum, int bass_shift )
+{
+	for ( long n = count; n--; )
+	{
+		long s = accum >> accum_fract;
+		accum -= accum >> bass_shift;
+		accum += (long (*buf++) - sample_offset) << accum_fract;
+		*out = (BOOST::int16_t) s;
+
+		// clamp sample
+		if ( (BOOST::int16_t) s != s )
+			*out = BOOST::int16_t (0x7FFF - (s >> 24));
+		out += stride;
+	}
+	return accum;
+}
+
+#if BLIP_SIMD_READ
+
+// Runs the integrator over one block of pre-converted input. The output level
+// 's' stays far inside 32 bits since it tracks the synthesized waveform, so
+// narrowing it here matches the scalar clamp exactly.
+static inline long integrate_block( const int32_t_* in, int32_t_* s, int count,
+		long accum, int bass_shift )
+{
+	for ( int i = 0; i < count; i++ )
+	{
+		s [i] = int32_t_ (accum >> accum_fract);
+		accum -= accum >> bass_shift;
+		accum += in [i];
+	}
+	return accum;
+}
+
+#endif
+
+#if BLIP_SIMD_X86
+
+// SSE2
+
+// Low 32 bits of a 32x32 multiply; SSE2 lacks pmulld
+static inline __m128i mullo_sse2( __m128i a, __m128i b )
+{
+	__m128i even = _mm_mul_epu32( a, b );
+	__m128i odd  = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), _mm_srli_epi64( b, 32 ) );
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ),
+			_mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+}
+
+// Sums adjacent lanes: { a0+a1, a2+a3, b0+b1, b2+b3 }
+static inline __m128i pair_sum_sse2( __m128i a, __m128i b )
+{
+	__m128 fa = _mm_castsi128_ps( a );
+	__m128 fb = _mm_castsi128_ps( b );
+	__m128i even = _mm_castps_si128( _mm_shuffle_ps( fa, fb, _MM_SHUFFLE( 2, 0, 2, 0 ) ) );
+	__m128i odd  = _mm_castps_si128( _mm_shuffle_ps( fa, fb, _MM_SHUFFLE( 3, 1, 3, 1 ) ) );
+	return _mm_add_epi32( even, odd );
+}
+
+#if BLIP_SIMD_READ
+
+// Applies the scalar clamp to four 32-bit levels and sign-extends the 16-bit
+// result, ready for a (then lossless) saturating pack
+static inline __m128i clamp_sse2( __m128i s )
+{
+	__m128i narrow  = _mm_srai_epi32( _mm_slli_epi32( s, 16 ), 16 );
+	__m128i in_range = _mm_cmpeq_epi32( narrow, s );
+	__m128i wrapped = _mm_sub_epi32( _mm_set1_epi32( 0x7FFF ), _mm_srai_epi32( s, 24 ) );
+	wrapped = _mm_srai_epi32( _mm_slli_epi32( wrapped, 16 ), 16 );
+	return _mm_or_si128( _mm_and_si128( in_range, narrow ),
+			_mm_andnot_si128( in_range, wrapped ) );
+}
+
+#endif
+
+static void add_impulse_sse2( pair_t* buf, const pair_t* imp, int count,
+		pair_t offset, int delta )
+{
+	__m128i vo = _mm_set1_epi32( (int) offset );
+	__m128i vd = _mm_set1_epi32( delta );
+	for ( ; count >= 4; count -= 4 )
+	{
+		__m128i t = _mm_loadu_si128( (const __m128i*) buf );
+		__m128i i = _mm_loadu_si128( (const __m128i*) imp );
+		t = _mm_add_epi32( _mm_sub_epi32( t, vo ), mullo_sse2( i, vd ) );
+		_mm_storeu_si128( (__m128i*) buf, t );
+		buf += 4;
+		imp += 4;
+	}
+	for ( ; count; --count )
+		*buf++ += *imp++ * delta - offset;
+}
+
+static void add_fine_impulse_sse2( pair_t* buf, const pair_t* imp, int count,
+		pair_t offset, int delta2, int delta )
+{
+	__m128i vo = _mm_set1_epi32( (int) offset );
+	__m128i vd = _mm_set_epi32( delta, delta2, delta, delta2 );
+	for ( ; count >= 4; count -= 4 )
+	{
+		__m128i p0 = mullo_sse2( _mm_loadu_si128( (const __m128i*) imp ), vd );
+		__m128i p1 = mullo_sse2( _mm_loadu_si128( (const __m128i*) (imp + 4) ), vd );
+		__m128i t = _mm_loadu_si128( (const __m128i*) buf );
+		t = _mm_add_epi32( _mm_sub_epi32( t, vo ), pair_sum_sse2( p0, p1 ) );
+		_mm_storeu_si128( (__m128i*) buf, t );
+		buf += 4;
+		imp += 8;
+	}
+	for ( ; count; --count )
+	{
+		*buf++ += imp [0] * delta2 + imp [1] * delta - offset;
+		imp += 2;
+	}
+}
+
+#if BLIP_SIMD_READ
+
+static long read_samples_sse2( const BOOST::uint16_t* buf, BOOST::int16_t* out, long count,
+		int stride, long accum, int bass_shift )
+{
+	union {
+		int32_t_ i32 [block_size];
+		__m128i  v [block_size / 4];
+	} in, s;
+	BOOST::int16_t packed [block_size];
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i offset = _mm_set1_epi32( sample_offset );
+
+	while ( count )
+	{
+		int n = (count < block_size ? (int) count : (int) block_size);
+
+		// convert raw samples to integrator steps
+		int i = 0;
+		for ( ; i + 8 <= n; i += 8 )
+		{
+			__m128i raw = _mm_loadu_si128( (const __m128i*) (buf + i) );
+			__m128i lo = _mm_sub_epi32( _mm_unpacklo_epi16( raw, zero ), offset );
+			__m128i hi = _mm_sub_epi32( _mm_unpackhi_epi16( raw, zero ), offset );
+			in.v [i / 4]     = _mm_slli_epi32( lo, accum_fract );
+			in.v [i / 4 + 1] = _mm_slli_epi32( hi, accum_fract );
+		}
+		for ( ; i < n; i++ )
+			in.i32 [i] = (int32_t_ (buf [i]) - sample_offset) << accum_fract;
+
+		accum = integrate_block( in.i32, s.i32, n, accum, bass_shift );
+
+		// clamp and narrow
+		for ( i = 0; i < n; i += 8 )
+		{
+			__m128i v = _mm_packs_epi32( clamp_sse2( s.v [i / 4] ), clamp_sse2( s.v [i / 4 + 1] ) );
+			if ( stride == 1 && i + 8 <= n )
+				_mm_storeu_si128( (__m128i*) (out + i), v );
+			else
+				_mm_storeu_si128( (__m128i*) (packed + i), v );
+		}
+		if ( stride == 1 )
+		{
+			int tail = n & ~7;
+			memcpy( out + tail, packed + tail, (n - tail) * sizeof *out );
+			out += n;
+		}
+		else
+		{
+			for ( i = 0; i < n; i++ )
+				out [i * stride] = packed [i];
+			out += n * stride;
+		}
+
+		buf += n;
+		count -= n;
+	}
+	return accum;
+}
+
+#endif
+
+// AVX2
+
+BLIP_TARGET_AVX2
+static void add_impulse_avx2( pair_t* buf, const pair_t* imp, int count,
+		pair_t offset, int delta )
+{
+	__m256i vo = _mm256_set1_epi32( (int) offset );
+	__m256i vd = _mm256_set1_epi32( delta );
+	for ( ; count >= 8; count -= 8 )
+	{
+		__m256i t = _mm256_loadu_si256( (const __m256i*) buf );
+		__m256i i = _mm256_loadu_si256( (const __m256i*) imp );
+		t = _mm256_add_epi32( _mm256_sub_epi32( t, vo ), _mm256_mullo_epi32( i, vd ) );
+		_mm256_storeu_si256( (__m256i*) buf, t );
+		buf += 8;
+		imp += 8;
+	}
+	if ( count >= 4 )
+	{
+		__m128i t = _mm_loadu_si128( (const __m128i*) buf );
+		__m128i i = _mm_loadu_si128( (const __m128i*) imp );
+		t = _mm_add_epi32( _mm_sub_epi32( t, _mm256_castsi256_si128( vo ) ),
+				_mm_mullo_epi32( i, _mm256_castsi256_si128( vd ) ) );
+		_mm_storeu_si128( (__m128i*) buf, t );
+		buf += 4;
+		imp += 4;
+		count -= 4;
+	}
+	for ( ; count; --count )
+		*buf++ += *imp++ * delta - offset;
+}
+
+BLIP_TARGET_AVX2
+static void add_fine_impulse_avx2( pair_t* buf, const pair_t* imp, int count,
+		pair_t offset, int delta2, int delta )
+{
+	__m256i vo = _mm256_set1_epi32( (int) offset );
+	__m256i vd = _mm256_set_epi32( delta, delta2, delta, delta2, delta, delta2, delta, delta2 );
+	for ( ; count >= 8; count -= 8 )
+	{
+		__m256i p0 = _mm256_mullo_epi32( _mm256_loadu_si256( (const __m256i*) imp ), vd );
+		__m256i p1 = _mm256_mullo_epi32( _mm256_loadu_si256( (const __m256i*) (imp + 8) ), vd );
+		// hadd works within 128-bit halves; restore pair order afterwards
+		__m256i sum = _mm256_permute4x64_epi64( _mm256_hadd_epi32( p0, p1 ), _MM_SHUFFLE( 3, 1, 2, 0 ) );
+		__m256i t = _mm256_loadu_si256( (const __m256i*) buf );
+		t = _mm256_add_epi32( _mm256_sub_epi32( t, vo ), sum );
+		_mm256_storeu_si256( (__m256i*) buf, t );
+		buf += 8;
+		imp += 16;
+	}
+	if ( count >= 4 )
+	{
+		__m128i d = _mm256_castsi256_si128( vd );
+		__m128i p0 = _mm_mullo_epi32( _mm_loadu_si128( (const __m128i*) imp ), d );
+		__m128i p1 = _mm_mullo_epi32( _mm_loadu_si128( (const __m128i*) (imp + 4) ), d );
+		__m128i t = _mm_loadu_si128( (const __m128i*) buf );
+		t = _mm_add_epi32( _mm_sub_epi32( t, _mm256_castsi256_si128( vo ) ), _mm_hadd_epi32( p0, p1 ) );
+		_mm_storeu_si128( (__m128i*) buf, t );
+		buf += 4;
+		imp += 8;
+		count -= 4;
+	}
+	for ( ; count; --count )
+	{
+		*buf++ += imp [0] * delta2 + imp [1] * delta - offset;
+		imp += 2;
+	}
+}
+
+#if BLIP_SIMD_READ
+
+BLIP_TARGET_AVX2
+static inline __m256i clamp_avx2( __m256i s )
+{
+	__m256i narrow  = _mm256_srai_epi32( _mm256_slli_epi32( s, 16 ), 16 );
+	__m256i in_range = _mm256_cmpeq_epi32( narrow, s );
+	__m256i wrapped = _mm256_sub_epi32( _mm256_set1_epi32( 0x7FFF ), _mm256_srai_epi32( s, 24 ) );
+	wrapped = _mm256_srai_epi32( _mm256_slli_epi32( wrapped, 16 ), 16 );
+	return _mm256_blendv_epi8( wrapped, narrow, in_range );
+}
+
+BLIP_TARGET_AVX2
+static long read_samples_avx2( const BOOST::uint16_t* buf, BOOST::int16_t* out, long count,
+		int stride, long accum, int bass_shift )
+{
+	union {
+		int32_t_ i32 [block_size];
+		__m256i  v [block_size / 8];
+	} in, s;
+	BOOST::int16_t packed [block_size];
+	const __m256i offset = _mm256_set1_epi32( sample_offset );
+
+	while ( count )
+	{
+		int n = (count < block_size ? (int) count : (int) block_size);
+
+		// convert raw samples to integrator steps
+		int i = 0;
+		for ( ; i + 8 <= n; i += 8 )
+		{
+			__m256i raw = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*) (buf + i) ) );
+			in.v [i / 8] = _mm256_slli_epi32( _mm256_sub_epi32( raw, offset ), accum_fract );
+		}
+		for ( ; i < n; i++ )
+			in.i32 [i] = (int32_t_ (buf [i]) - sample_offset) << accum_fract;
+
+		accum = integrate_block( in.i32, s.i32, n, accum, bass_shift );
+
+		// clamp and narrow
+		for ( i = 0; i < n; i += 8 )
+		{
+			__m256i c = clamp_avx2( s.v [i / 8] );
+			__m128i v = _mm_packs_epi32( _mm256_castsi256_si128( c ), _mm256_extracti128_si256( c, 1 ) );
+			if ( stride == 1 && i + 8 <= n )
+				_mm_storeu_si128( (__m128i*) (out + i), v );
+			else
+				_mm_storeu_si128( (__m128i*) (packed + i), v );
+		}
+		if ( stride == 1 )
+		{
+			int tail = n & ~7;
+			memcpy( out + tail, packed + tail, (n - tail) * sizeof *out );
+			out += n;
+		}
+		else
+		{
+			for ( i = 0; i < n; i++ )
+				out [i * stride] = packed [i];
+			out += n * stride;
+		}
+
+		buf += n;
+		count -= n;
+	}
+	return accum;
+}
+
+#endif
+
+static int detect_simd()
+{
+	#if defined (_MSC_VER)
+		int info [4];
+		__cpuid( info, 0 );
+		if ( info [0] < 7 )
+			return blip_simd_sse2;
+		__cpuid( info, 1 );
+		bool osxsave = (info [2] >> 27) & 1;
+		bool avx = (info [2] >> 28) & 1;
+		if ( !osxsave || !avx || (_xgetbv( 0 ) & 6) != 6 )
+			return blip_simd_sse2;
+		__cpuidex( info, 7, 0 );
+		return (info [1] >> 5) & 1 ? blip_simd_avx2 : blip_simd_sse2;
+	#elif defined (__GNUC__) || defined (__clang__)
+		__builtin_cpu_init();
+		if ( __builtin_cpu_supports( "avx2" ) )
+			return blip_simd_avx2;
+		return __builtin_cpu_supports( "sse2" ) ? blip_simd_sse2 : blip_simd_scalar;
+	#else
+		return blip_simd_sse2;
+	#endif
+}
+
+#else
+
+static int detect_simd()
+{
+	return blip_simd_scalar;
+}
+
+#endif
+
+#if BLIP_SIMD_READ
+	#define BLIP_READ( kernel ) kernel
+#else
+	#define BLIP_READ( kernel ) read_samples_scalar
+#endif
+
+static const blip_kernels_t kernel_table [] = {
+	{ "scalar", blip_simd_scalar, NULL, NULL, read_samples_scalar },
+#if BLIP_SIMD_X86
+	{ "sse2", blip_simd_sse2, add_impulse_sse2, add_fine_impulse_sse2, BLIP_READ( read_samples_sse2 ) },
+	{ "avx2", blip_simd_avx2, add_impulse_avx2, add_fine_impulse_avx2, BLIP_READ( read_samples_avx2 ) },
+#endif
+};
+
+int blip_simd_supported()
+{
+	static const int level = detect_simd();
+	return level;
+}
+
+const blip_kernels_t* blip_kernels( int level )
+{
+	int supported = blip_simd_supported();
+	if ( level < 0 || level > supported )
+		level = supported;
+	return &kernel_table [level];
+}
+
@@ -0,0 +1,63 @@
+
+// SIMD kernels for Blip_Synth impulse accumulation and (with BLIP_SIMD_READ)
+// Blip_Buffer sample read-out, selected at run time from the features of the
+// host CPU. Every kernel produces output bit-identical to the scalar code it
+// replaces.
+
+#ifndef BLIP_SIMD_H
+#define BLIP_SIMD_H
+
+#include "blargg_common.h"
+
+// Instruction set levels. Higher levels are only used if the CPU supports them.
+enum {
+	blip_simd_auto   = -1, // best level supported by this CPU
+	blip_simd_scalar = 0,
+	blip_simd_sse2   = 1,
+	blip_simd_avx2   = 2
+};
+
+// Blip_Synth only calls the impulse kernels for impulses at least this many
+// samples wide. The NES channels' synths are 12 wide, and for them the call
+// through the table costs more than the vector loop saves (see apu_bench).
+#ifndef BLIP_SIMD_MIN_WIDTH
+	#define BLIP_SIMD_MIN_WIDTH 16
+#endif
+
+// Nonzero to read samples out with the vector kernels too. The integrator is
+// serial, so they only speed up the conversion and clamping around it, and at
+// the NES's 735 samples a frame that is lost in the noise (see apu_bench).
+// Off by default, which leaves vector code only in the impulse kernels.
+#ifndef BLIP_SIMD_READ
+	#define BLIP_SIMD_READ 0
+#endif
+
+struct blip_kernels_t {
+	const char* name;
+	int level;
+
+	// Add 'count' 32-bit impulse pairs scaled by 'delta' into 'buf', subtracting
+	// 'offset' from each. NULL means Blip_Synth uses its inline scalar loop.
+	void (*add_impulse)( BOOST::uint32_t* buf, const BOOST::uint32_t* imp, int count,
+			BOOST::uint32_t offset, int delta );
+
+	// Fine mode version of above; 'imp' holds two entries per output pair, the
+	// first scaled by 'delta2' and the second by 'delta'.
+	void (*add_fine_impulse)( BOOST::uint32_t* buf, const BOOST::uint32_t* imp, int count,
+			BOOST::uint32_t offset, int delta2, int delta );
+
+	// Integrate and high-pass filter 'count' raw samples from 'in' into 'out',
+	// writing every 'stride' samples. Returns the new integrator value. The
+	// scalar loop at every level unless BLIP_SIMD_READ is set.
+	long (*read_samples)( const BOOST::uint16_t* in, BOOST::int16_t* out, long count,
+			int stride, long accum, int bass_shift );
+};
+
+// Kernels for specified level, reduced to the highest level this CPU supports
+const blip_kernels_t* blip_kernels( int level = blip_simd_auto );
+
+// Highest level supported by this CPU
+int blip_simd_supported();
+
+#endif
+
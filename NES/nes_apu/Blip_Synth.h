@@ -149,9 +149,16 @@ inline void Blip_Synth<quality,range>::offset_resampled( blip_resampled_time_t t
 	
 	pair_t offset = impulse.offset * delta;
 	
+	const blip_kernels_t* kernels = blip_buf->kernels_;
 	if ( !fine_bits )
 	{
 		// normal mode
+		if ( width >= BLIP_SIMD_MIN_WIDTH && kernels->add_impulse )
+		{
+			kernels->add_impulse( buf, imp, width / 2, offset, delta );
+			return;
+		}
+		
 		for ( int n = width / 4; n; --n )
 		{
 			pair_t t0 = buf [0] - offset;
@@ -174,6 +181,12 @@ inline void Blip_Synth<quality,range>::offset_resampled( blip_resampled_time_t t
 		int delta2 = (delta & (sub_range - 1)) - sub_range / 2;
 		delta >>= fine_bits;
 		
+		if ( width >= BLIP_SIMD_MIN_WIDTH && kernels->add_fine_impulse )
+		{
+			kernels->add_fine_impulse( buf, imp, width / 2, offset, delta2, delta );
+			return;
+		}
+		
 		for ( int n = width / 4; n; --n )
 		{
 			pair_t t0 = buf [0] - offset;
@@ -3,6 +3,8 @@
 #include "apu_snapshot.h"
 #include "Nes_Apu.h"
 
+#include <string.h>
+
 /* Copyright (C) 2003-2005 Shay Green. This module is free software; you
 can redistribute it and/or modify it under the terms of the GNU Lesser
 General Public License as published by the Free Software Foundation; either
@@ -42,6 +44,7 @@ struct apu_reflection
 	{
 		REFLECT(state.delay, osc.delay);
 		REFLECT(state.length, osc.length_counter);
+		REFLECT(state.phase, osc.phase);
 		REFLECT(state.linear_counter, osc.linear_counter);
 		REFLECT(state.linear_mode, osc.reg_written[3]);
 	}
@@ -73,6 +76,7 @@ struct apu_reflection
 
 void Nes_Apu::save_snapshot(apu_snapshot_t* state) const
 {
+	memset( state, 0, sizeof *state ); // padding too, so equal states are equal bytes
 	for (int i = 0; i < osc_count * 4; i++)
 		state->w40xx[i] = oscs[i >> 2]->regs[i & 3];
 	state->w40xx[0x11] = dmc.dac;
@@ -82,6 +86,9 @@ void Nes_Apu::save_snapshot(apu_snapshot_t* state) const
 	state->delay = frame_delay;
 	state->step = frame;
 	state->irq_flag = irq_flag;
+	state->irq_delay = -1;
+	if (next_irq != no_irq)
+		state->irq_delay = (next_irq > last_time) ? next_irq - last_time : 0;
 
 	typedef apu_reflection<1> refl;
 	Nes_Apu& apu = *(Nes_Apu*)this; // const_cast
@@ -90,6 +97,8 @@ void Nes_Apu::save_snapshot(apu_snapshot_t* state) const
 	refl::reflect_triangle(state->triangle, apu.triangle);
 	refl::reflect_noise(state->noise, apu.noise);
 	refl::reflect_dmc(state->dmc, apu.dmc);
+	for (int i = 0; i < 4; i++)
+		state->last_amp[i] = oscs[i]->last_amp;
 }
 
 void Nes_Apu::load_snapshot(apu_snapshot_t const& state)
@@ -119,4 +128,14 @@ void Nes_Apu::load_snapshot(apu_snapshot_t const& state)
 	refl::reflect_dmc(st.dmc, dmc);
 	dmc.recalc_irq();
 	dmc.last_amp = dmc.dac;
+
+	// continue from the levels already in the output buffer, so there is no click
+	for (int i = 0; i < 4; i++)
+		oscs[i]->last_amp = state.last_amp[i];
+
+	// writing $4017 above restarted the frame IRQ timer
+	next_irq = no_irq;
+	if (state.irq_delay >= 0)
+		next_irq = state.irq_delay;
+	irq_changed();
 }
\ No newline at end of file
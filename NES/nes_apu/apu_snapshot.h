@@ -65,9 +65,12 @@ struct apu_snapshot_t
 		byte irq_flag;
 	} dmc;
 
+	byte last_amp[4]; // levels last output by squares, triangle and noise
+	BOOST::int32_t irq_delay; // clocks until frame IRQ, or -1 if none
+
 	enum { tag = 'APUR' };
 	void swap();
 };
-BOOST_STATIC_ASSERT(sizeof(apu_snapshot_t) == 72);
+BOOST_STATIC_ASSERT(sizeof(apu_snapshot_t) == 80);
 
 #endif
@@ -0,0 +1,104 @@
+#include "observation.h"
+#include "palette.h"
+#include <algorithm>
+#include <cstring>
+
+Observation::Observation() : out_width(0), out_height(0), ring(nullptr), frame_count(0)
+{
+    for (int c = 0; c < 64; c++) {
+        const quint8 *rgb = RGBColorMap[c];
+        gray[c] = quint8((rgb[0] * 299 + rgb[1] * 587 + rgb[2] * 114 + 500) / 1000);
+    }
+    set_format(ObservationFormat());
+}
+
+bool Observation::set_format(const ObservationFormat &format)
+{
+    const ObservationFormat &f = format;
+    if (f.scale < 1 || f.scale > 16 || f.stack < 1 || f.crop_x < 0 || f.crop_y < 0
+        || f.crop_width < f.scale || f.crop_height < f.scale || f.crop_x + f.crop_width > 256
+        || f.crop_y + f.crop_height > 240
+        || (f.max_two_frames && f.kind != ObservationFormat::Gray))
+        return false;
+
+    fmt = format;
+    out_width = f.crop_width / f.scale;
+    out_height = f.crop_height / f.scale;
+
+    bool sample = f.kind == ObservationFormat::PaletteIndex;
+    for (int x = 0; x < 256; x++) {
+        int cell = (x - f.crop_x) / f.scale;
+        bool keep = x >= f.crop_x && cell < out_width && (!sample || (x - f.crop_x) % f.scale == 0);
+        column_cell[x] = keep ? cell : -1;
+    }
+    for (int y = 0; y < 240; y++) {
+        int cell = (y - f.crop_y) / f.scale;
+        bool keep = y >= f.crop_y && cell < out_height && (!sample || (y - f.crop_y) % f.scale == 0);
+        row_cell[y] = keep ? cell * out_width : -1;
+    }
+
+    sums.assign(frame_size(), 0);
+    last.assign(frame_size(), 0);
+    own_buffer.assign(stack_size(), 0);
+    ring = own_buffer.data();
+    frame_count = 0;
+    return true;
+}
+
+void Observation::set_gray_table(const quint8 table[64])
+{
+    memcpy(gray, table, sizeof(gray));
+}
+
+void Observation::set_buffer(quint8 *buffer)
+{
+    ring = buffer ? buffer : own_buffer.data();
+    clear();
+}
+
+void Observation::clear()
+{
+    std::fill(sums.begin(), sums.end(), 0);
+    std::fill(last.begin(), last.end(), 0);
+    memset(ring, 0, stack_size());
+    frame_count = 0;
+}
+
+const quint8 *Observation::latest() const
+{
+    int slot = int((frame_count + fmt.stack - 1) % fmt.stack);
+    return ring + slot * frame_size();
+}
+
+void Observation::copy_stack(quint8 *out) const
+{
+    for (int i = 0; i < fmt.stack; i++) {
+        int slot = int((frame_count + i) % fmt.stack);
+        memcpy(out + i * frame_size(), ring + slot * frame_size(), frame_size());
+    }
+}
+
+// Frame n goes to slot n % stack of the ring
+void Observation::end_frame()
+{
+    quint8 *out = ring + int(frame_count % fmt.stack) * frame_size();
+    int size = frame_size();
+    if (fmt.kind == ObservationFormat::Gray) {
+        int area = fmt.scale * fmt.scale;
+        for (int i = 0; i < size; i++)
+            out[i] = quint8(sums[i] / area);
+        std::fill(sums.begin(), sums.end(), 0);
+    } else {
+        for (int i = 0; i < size; i++)
+            out[i] = quint8(sums[i]);
+    }
+
+    if (fmt.max_two_frames) {
+        for (int i = 0; i < size; i++) {
+            quint8 now = out[i];
+            out[i] = qMax(now, last[i]);
+            last[i] = now;
+        }
+    }
+    frame_count++;
+}
@@ -0,0 +1,80 @@
+#ifndef OBSERVATION_H
+#define OBSERVATION_H
+
+#include <QtGlobal>
+#include <vector>
+
+// What an agent sees each frame, built by the PPU while it draws instead of
+// from frame_data afterwards, so the RGB picture can be skipped altogether.
+struct ObservationFormat
+{
+    enum Kind {
+        Gray,        // one byte per pixel through the grayscale table, cells averaged
+        PaletteIndex // the NES color (0-63) of the top left pixel of each cell
+    };
+
+    Kind kind = Gray;
+    int crop_x = 0, crop_y = 0; // the part of the 256x240 picture to keep
+    int crop_width = 256, crop_height = 240;
+    int scale = 1;              // cells of scale x scale pixels become one, the rest is dropped
+    bool max_two_frames = false; // each pixel is the brighter of this frame and the last, for sprites that flicker
+    int stack = 1;              // frames kept, oldest first
+};
+
+class Observation
+{
+public:
+    Observation();
+
+    // Fails if the crop doesn't fit in the picture or is smaller than a cell,
+    // or max_two_frames is asked for palette indexes
+    bool set_format(const ObservationFormat &format);
+    const ObservationFormat &format() const { return fmt; }
+    int width() const { return out_width; }
+    int height() const { return out_height; }
+    int frame_size() const { return out_width * out_height; }
+    int stack_size() const { return frame_size() * fmt.stack; }
+
+    // Gray levels for the 64 colors, luma of the RGB palette by default
+    void set_gray_table(const quint8 table[64]);
+
+    // Keep the stacked frames in the caller's buffer of stack_size() bytes
+    // instead of our own. nullptr goes back to our own.
+    void set_buffer(quint8 *buffer);
+
+    void clear();                                // forget the frames so far
+    quint64 frames() const { return frame_count; } // frames finished since clear()
+    const quint8 *latest() const;                // the newest frame
+    void copy_stack(quint8 *out) const;          // stack_size() bytes, oldest frame first
+
+    // Called by the PPU for every visible pixel and at the end of each frame
+    inline void pixel(int x, int y, quint8 color)
+    {
+        int col = column_cell[x], row = row_cell[y];
+        if ((col | row) < 0)
+            return;
+        if (fmt.kind == ObservationFormat::Gray)
+            sums[row + col] += gray[color];
+        else
+            sums[row + col] = color;
+    }
+    void end_frame();
+
+private:
+    ObservationFormat fmt;
+    int out_width, out_height;
+    quint8 gray[64];
+
+    // cell of each picture column and row offset of each picture row, -1 if
+    // dropped. In PaletteIndex mode only the first pixel of a cell is kept.
+    int column_cell[256];
+    int row_cell[240];
+
+    std::vector<quint16> sums;  // the frame being drawn
+    std::vector<quint8> last;   // the frame before, for max_two_frames
+    std::vector<quint8> own_buffer;
+    quint8 *ring;               // fmt.stack frames
+    quint64 frame_count;
+};
+
+#endif // OBSERVATION_H
@@ -1,6 +1,10 @@
 #include "ppu.h"
+#include "savestate.h"
 
-PPU::PPU() {}
+PPU::PPU() : cart(nullptr)
+{
+    reset(); // so nothing is left undefined before the first reset
+}
 
 PPU::~PPU() {}
 
@@ -26,19 +30,55 @@ void PPU::reset()
     vram_addr.reg = 0x0000;
     tram_addr.reg = 0x0000;
     odd_frame = false;
+    nmi = false;
+    vblank_read = false;
+
+    oam_addr = 0x00;
+    sprite_count = 0;
+    bSpriteZeroHitPossible = false;
+    bSpriteZeroBeingRendered = false;
+    memset(OAM, 0, sizeof(OAM));
+    memset(spriteScanline, 0, sizeof(spriteScanline));
+    memset(sprite_shifter_pattern_lo, 0, sizeof(sprite_shifter_pattern_lo));
+    memset(sprite_shifter_pattern_hi, 0, sizeof(sprite_shifter_pattern_hi));
 
     memset(frame_data, 0, sizeof(quint8) * 256 * 240 * 3);
     memset(tblName, 0, sizeof(quint8) * 1024 * 2);
     memset(tblPalette, 0, sizeof(quint8) * 32);
 }
 
+void PPU::soft_reset()
+{
+    control.reg = 0x00;
+    mask.reg = 0x00;
+    address_latch = false;
+    fine_x = 0x00;
+    tram_addr.reg = 0x0000; // PPUSCROLL cleared
+    ppu_data_buffer = 0x00;
+    odd_frame = false;
+    nmi = false;
+}
+
 void PPU::ConnectCartridge(Cartridge *cartridge)
 {
     this->cart = cartridge;
 }
 
-quint8 PPU::get_status()
+quint8 PPU::get_status(int dots_ahead)
 {
+    // The CPU runs an instruction on its first cycle but reads on its last.
+    // If vertical blank starts in between, the read sees the flag and clears
+    // it, and the flag isn't set again when the PPU gets there. Without this,
+    // an NMI handler reading $2002 keeps an LDA $2002 / BPL loop from ever
+    // seeing it set.
+    if (dots_ahead > 0 && !status.vertical_blank) {
+        int until = scanline == 241 ? 1 - cycle : scanline == 240 ? 342 - cycle : -1;
+        if (until >= 0 && until < dots_ahead) {
+            status.vertical_blank = 1;
+            vblank_read = true;
+        }
+    }
+
     // Actually the high 3bit is enough
     quint8 data = (status.reg & 0xE0) | (ppu_data_buffer & 0x1F);
 
@@ -136,6 +176,11 @@ quint8 PPU::ppuRead(quint16 addr)
     } else if (addr >= 0x2000 && addr <= 0x3EFF) {
         addr &= 0x0FFF;
 
+        // four-screen boards bring 2KB for the two lower nametables and
+        // ignore the mirroring
+        if (quint8 *extra = cart->mapper_ptr->nametable_ram)
+            return addr < 0x0800 ? tblName[addr >> 10][addr & 0x03FF] : extra[addr & 0x07FF];
+
         switch (cart->mapper_ptr->nametable_mirror) {
         case MirrorMode::HORIZONTAL:
             if (addr >= 0x0000 && addr <= 0x03FF)
@@ -194,6 +239,13 @@ void PPU::ppuWrite(quint16 addr, quint8 data)
         cart->PpuWrite(addr, data);
     } else if (addr >= 0x2000 && addr <= 0x3EFF) {
         addr &= 0x0FFF;
+        if (quint8 *extra = cart->mapper_ptr->nametable_ram) {
+            if (addr < 0x0800)
+                tblName[addr >> 10][addr & 0x03FF] = data;
+            else
+                extra[addr & 0x07FF] = data;
+            return;
+        }
         switch (cart->mapper_ptr->nametable_mirror) {
         case MirrorMode::HORIZONTAL:
             if (addr >= 0x0000 && addr <= 0x03FF)
@@ -624,7 +676,9 @@ void PPU::clock()
     if (scanline >= 241 && scanline < 261) {
         if (scanline == 241 && cycle == 1) {
             // Effectively end of frame, so set vertical blank flag
-            status.vertical_blank = 1;
+            if (!vblank_read)
+                status.vertical_blank = 1;
+            vblank_read = false;
 
             // emit a NMI signal to CPU
             if (control.enable_nmi)
@@ -759,11 +813,15 @@ void PPU::clock()
 
     // Finally，save the pixel value into frame_data
     int x = cycle - 1, y = scanline;
-    if (x >= 0 && x < 256 && y >= 0 && y < 240) {
+    if ((video_output || observation) && x >= 0 && x < 256 && y >= 0 && y < 240) {
         quint8 palette_addr = ppuRead(0x3F00 + (palette << 2) + pixel) & 0x3F;
-        frame_data[x][y][0] = RGBColorMap[palette_addr][0];
-        frame_data[x][y][1] = RGBColorMap[palette_addr][1];
-        frame_data[x][y][2] = RGBColorMap[palette_addr][2];
+        if (video_output) {
+            frame_data[y][x][0] = RGBColorMap[palette_addr][0];
+            frame_data[y][x][1] = RGBColorMap[palette_addr][1];
+            frame_data[y][x][2] = RGBColorMap[palette_addr][2];
+        }
+        if (observation)
+            observation->pixel(x, y, palette_addr);
     }
 
     // Advance renderer - it never stops, it's relentless
@@ -781,128 +839,55 @@ void PPU::clock()
             scanline = -1;
             frame_complete = true;
             odd_frame = !odd_frame;
+            if (observation)
+                observation->end_frame();
         }
     }
 }
 
-QDataStream &operator<<(QDataStream &stream, const PPU &Ppu)
-{
-    for (int i = 0; i < 2; i++)
-        for (int j = 0; j < 1024; j++)
-            stream << Ppu.tblName[i][j];
-
-    for (int i = 0; i < 32; i++)
-        stream << Ppu.tblPalette[i];
-
-    stream << Ppu.status.reg;
-    stream << Ppu.mask.reg;
-    stream << Ppu.control.reg;
-    stream << Ppu.vram_addr.reg;
-    stream << Ppu.tram_addr.reg;
-
-    stream << Ppu.fine_x;
-    stream << Ppu.address_latch;
-
-    stream << Ppu.ppu_data_buffer;
-
-    stream << Ppu.scanline;
-    stream << Ppu.cycle;
-    stream << Ppu.odd_frame;
-
-    stream << Ppu.bg_next_tile_id;
-    stream << Ppu.bg_next_tile_attrib;
-
-    stream << Ppu.bg_next_tile_lsb;
-    stream << Ppu.bg_next_tile_msb;
-
-    stream << Ppu.bg_shifter_pattern_lo;
-    stream << Ppu.bg_shifter_pattern_hi;
-    stream << Ppu.bg_shifter_attrib_lo;
-    stream << Ppu.bg_shifter_attrib_hi;
-
-    for (int i = 0; i < 64; i++) {
-        stream << Ppu.OAM[i].y;
-        stream << Ppu.OAM[i].id;
-        stream << Ppu.OAM[i].attribute;
-        stream << Ppu.OAM[i].x;
-    }
-
-    stream << Ppu.oam_addr;
-    stream << Ppu.sprite_count;
-    for (int i = 0; i < 8; i++) {
-        stream << Ppu.spriteScanline[i].y;
-        stream << Ppu.spriteScanline[i].id;
-        stream << Ppu.spriteScanline[i].attribute;
-        stream << Ppu.spriteScanline[i].x;
-
-        stream << Ppu.sprite_shifter_pattern_lo[i];
-        stream << Ppu.sprite_shifter_pattern_hi[i];
-    }
-
-    stream << Ppu.bSpriteZeroHitPossible;
-    stream << Ppu.bSpriteZeroBeingRendered;
-    stream << Ppu.nmi;
-
-    return stream;
-}
-
-QDataStream &operator>>(QDataStream &stream, PPU &Ppu)
+void PPU::serialize(StateIO &io)
 {
-    for (int i = 0; i < 2; i++)
-        for (int j = 0; j < 1024; j++)
-            stream >> Ppu.tblName[i][j];
+    io.begin_chunk(STATE_TAG('P', 'P', 'U', ' '));
+    io.block(tblName, sizeof(tblName));
+    io.block(tblPalette, sizeof(tblPalette));
 
-    for (int i = 0; i < 32; i++)
-        stream >> Ppu.tblPalette[i];
+    io.pod(status.reg);
+    io.pod(mask.reg);
+    io.pod(control.reg);
+    io.pod(vram_addr.reg);
+    io.pod(tram_addr.reg);
 
-    stream >> Ppu.status.reg;
-    stream >> Ppu.mask.reg;
-    stream >> Ppu.control.reg;
-    stream >> Ppu.vram_addr.reg;
-    stream >> Ppu.tram_addr.reg;
+    io.pod(fine_x);
+    io.pod(address_latch);
 
-    stream >> Ppu.fine_x;
-    stream >> Ppu.address_latch;
+    io.pod(ppu_data_buffer);
 
-    stream >> Ppu.ppu_data_buffer;
+    io.pod(scanline);
+    io.pod(cycle);
+    io.pod(odd_frame);
 
-    stream >> Ppu.scanline;
-    stream >> Ppu.cycle;
-    stream >> Ppu.odd_frame;
+    io.pod(bg_next_tile_id);
+    io.pod(bg_next_tile_attrib);
 
-    stream >> Ppu.bg_next_tile_id;
-    stream >> Ppu.bg_next_tile_attrib;
+    io.pod(bg_next_tile_lsb);
+    io.pod(bg_next_tile_msb);
 
-    stream >> Ppu.bg_next_tile_lsb;
-    stream >> Ppu.bg_next_tile_msb;
+    io.pod(bg_shifter_pattern_lo);
+    io.pod(bg_shifter_pattern_hi);
+    io.pod(bg_shifter_attrib_lo);
+    io.pod(bg_shifter_attrib_hi);
 
-    stream >> Ppu.bg_shifter_pattern_lo;
-    stream >> Ppu.bg_shifter_pattern_hi;
-    stream >> Ppu.bg_shifter_attrib_lo;
-    stream >> Ppu.bg_shifter_attrib_hi;
-
-    for (int i = 0; i < 64; i++) {
-        stream >> Ppu.OAM[i].y;
-        stream >> Ppu.OAM[i].id;
-        stream >> Ppu.OAM[i].attribute;
-        stream >> Ppu.OAM[i].x;
-    }
-
-    stream >> Ppu.oam_addr;
-    stream >> Ppu.sprite_count;
-    for (int i = 0; i < 8; i++) {
-        stream >> Ppu.spriteScanline[i].y;
-        stream >> Ppu.spriteScanline[i].id;
-        stream >> Ppu.spriteScanline[i].attribute;
-        stream >> Ppu.spriteScanline[i].x;
-
-        stream >> Ppu.sprite_shifter_pattern_lo[i];
-        stream >> Ppu.sprite_shifter_pattern_hi[i];
-    }
+    io.block(OAM, sizeof(OAM));
 
-    stream >> Ppu.bSpriteZeroHitPossible;
-    stream >> Ppu.bSpriteZeroBeingRendered;
-    stream >> Ppu.nmi;
+    io.pod(oam_addr);
+    io.pod(sprite_count);
+    io.block(spriteScanline, sizeof(spriteScanline));
+    io.block(sprite_shifter_pattern_lo, sizeof(sprite_shifter_pattern_lo));
+    io.block(sprite_shifter_pattern_hi, sizeof(sprite_shifter_pattern_hi));
 
-    return stream;
+    io.pod(bSpriteZeroHitPossible);
+    io.pod(bSpriteZeroBeingRendered);
+    io.pod(nmi);
+    io.pod(vblank_read);
+    io.end_chunk();
 }
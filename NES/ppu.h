@@ -2,13 +2,13 @@
 #define PPU2_H
 
 #include "cartridge.h"
+#include "observation.h"
 #include "palette.h"
-#include <QDataStream>
+
+class StateIO;
 
 class PPU
 {
-    friend QDataStream &operator<<(QDataStream &stream, const PPU &Ppu); // Serialize
-    friend QDataStream &operator>>(QDataStream &stream, PPU &Ppu);       // Deserialize
 public:
     PPU();
     ~PPU();
@@ -18,8 +18,10 @@ private:
     quint8 tblPalette[32];   // palette (8 in all, 4 for background, 4 for sprites)
 
 public:
-    quint8 frame_data[256][240][3]; // save the RGB for each pixels
+    quint8 frame_data[240][256][3]; // save the RGB for each pixels, row by row
     bool frame_complete = false;    // flag indicate a frame has done
+    bool video_output = true;       // false skips filling frame_data, for frames nobody sees
+    Observation *observation = nullptr; // fed every pixel when set, whether video_output or not
 
 private:
     union PPUSTATUS {
@@ -178,8 +180,8 @@ private:
 
 public:
     // CPU relevant functions
-    // read
-    quint8 get_status();
+    // read. The CPU reads $2002 'dots_ahead' dots after asking, see get_status()
+    quint8 get_status(int dots_ahead = 0);
     quint8 get_oamdata();
     quint8 read_data();
 
@@ -206,7 +208,15 @@ public:
     void ConnectCartridge(Cartridge *cartridge);
     void clock();
     void reset();
-    bool nmi = false;
+    void soft_reset(); // the reset button: registers cleared, memories and VBL flag kept
+    void serialize(StateIO &io); // save/load state
+    bool nmi_enabled() const { return control.enable_nmi; }
+    int get_scanline() const { return scanline; }
+    int get_cycle() const { return cycle; }
+    bool nmi = false; // NMI edge latched at vertical blank, taken before the next instruction
+
+private:
+    bool vblank_read = false; // $2002 was read after the coming vertical blank started
 };
 
 #endif // PPU2_H
@@ -0,0 +1,177 @@
+#include "rewind.h"
+#include "bus.h"
+#include <cstring>
+
+// A delta is a list of runs: quint16 words to skip, quint16 words that
+// differ, then the XOR of those words.
+static int encode_delta(const char *older, const char *newer, int words, char *out)
+{
+    char *p = out;
+    int i = 0;
+    while (i < words) {
+        int skip_start = i;
+        quint64 a, b;
+        for (; i < words && i - skip_start < 0xFFFF; i++) {
+            memcpy(&a, older + i * 8, 8);
+            memcpy(&b, newer + i * 8, 8);
+            if (a != b)
+                break;
+        }
+        if (i == words)
+            break;
+
+        quint16 skip = quint16(i - skip_start);
+        char *header = p;
+        p += 4;
+        int count_start = i;
+        for (; i < words && i - count_start < 0xFFFF; i++) {
+            memcpy(&a, older + i * 8, 8);
+            memcpy(&b, newer + i * 8, 8);
+            if (a == b)
+                break;
+            a ^= b;
+            memcpy(p, &a, 8);
+            p += 8;
+        }
+        quint16 count = quint16(i - count_start);
+        memcpy(header, &skip, 2);
+        memcpy(header + 2, &count, 2);
+    }
+    return int(p - out);
+}
+
+static void apply_delta(char *state, const char *delta, int size)
+{
+    const char *end = delta + size;
+    char *dst = state;
+    while (delta < end) {
+        quint16 skip, count;
+        memcpy(&skip, delta, 2);
+        memcpy(&count, delta + 2, 2);
+        delta += 4;
+        dst += skip * 8;
+        for (int i = 0; i < count; i++) {
+            quint64 a, b;
+            memcpy(&a, dst, 8);
+            memcpy(&b, delta, 8);
+            a ^= b;
+            memcpy(dst, &a, 8);
+            dst += 8;
+            delta += 8;
+        }
+    }
+}
+
+RewindBuffer::RewindBuffer(int budget, int interval)
+    : budget(budget), interval(qMax(interval, 1)), frame_count(0), head(0), used(0), last_size(0)
+{}
+
+void RewindBuffer::set_budget(int bytes)
+{
+    budget = bytes;
+    ring = QByteArray();
+    clear();
+}
+
+void RewindBuffer::set_interval(int frames)
+{
+    interval = qMax(frames, 1);
+    clear();
+}
+
+void RewindBuffer::clear()
+{
+    entries.clear();
+    head = 0;
+    used = 0;
+    last_size = 0;
+    frame_count = 0;
+}
+
+void RewindBuffer::drop_oldest()
+{
+    used -= entries.front().size;
+    entries.pop_front();
+}
+
+// Find room for 'size' bytes in the ring, dropping the oldest deltas as needed
+int RewindBuffer::alloc(int size)
+{
+    if (size > budget)
+        return -1;
+    if (head + size > ring.size() && ring.size() < budget) {
+        // grow towards the budget instead of allocating it all at once;
+        // nothing has wrapped around yet, so the deltas keep their offsets
+        ring.resize(qMin(budget, qMax(ring.size() * 2, head + size + 0x10000)));
+    }
+
+    if (head + size > ring.size()) {
+        // wrap around; whatever is left past 'head' is from the previous lap, so the oldest
+        while (!entries.empty() && entries.front().offset >= head)
+            drop_oldest();
+        head = 0;
+    }
+    while (!entries.empty() && entries.front().offset >= head
+           && entries.front().offset < head + size)
+        drop_oldest();
+
+    int offset = head;
+    head += size;
+    return offset;
+}
+
+void RewindBuffer::capture(Bus &bus)
+{
+    if (++frame_count < interval)
+        return;
+    frame_count = 0;
+
+    bus.save_state(current);
+    int size = current.size();
+    int padded = (size + 7) & ~7;
+    current.resize(padded);
+    memset(current.data() + size, 0, padded - size);
+
+    if (size == last_size) {
+        // store the previous snapshot as its difference from this one
+        int words = padded / 8;
+        if (delta.size() < words * 12 + 8)
+            delta.resize(words * 12 + 8);
+        int delta_size = encode_delta(last.constData(), current.constData(), words, delta.data());
+        int offset = alloc(delta_size);
+        if (offset >= 0) {
+            memcpy(ring.data() + offset, delta.constData(), delta_size);
+            Entry e = {offset, delta_size};
+            entries.push_back(e);
+            used += delta_size;
+        } else {
+            clear();
+        }
+    } else {
+        entries.clear(); // first snapshot, or another game
+        used = 0;
+    }
+
+    last.swap(current);
+    last_size = size;
+}
+
+int RewindBuffer::rewind(Bus &bus, int frames)
+{
+    if (last_size == 0)
+        return 0;
+
+    int steps = (frames + interval - 1) / interval;
+    int done = 0;
+    for (; done < steps && !entries.empty(); done++) {
+        Entry e = entries.back();
+        entries.pop_back();
+        used -= e.size;
+        apply_delta(last.data(), ring.constData() + e.offset, e.size);
+        head = e.offset;
+    }
+
+    bus.load_state(QByteArray::fromRawData(last.constData(), last_size));
+    frame_count = 0;
+    return done * interval;
+}
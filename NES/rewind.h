@@ -0,0 +1,60 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <QByteArray>
+#include <QtGlobal>
+#include <deque>
+
+class Bus;
+
+// Keeps recent savestates so the game can be stepped backwards.
+// The newest state is kept whole; every older one is stored as the XOR
+// between it and the state after it, with runs of unchanged 8-byte words
+// skipped. Between two frames only a little RAM, a few nametable bytes and
+// the registers change, so a delta is usually a few hundred bytes.
+// Deltas live in a ring of 'budget' bytes; the oldest are dropped to make room.
+class RewindBuffer
+{
+public:
+    explicit RewindBuffer(int budget = 64 * 1024 * 1024, int interval = 1);
+
+    void set_budget(int bytes);     // clears the buffer
+    void set_interval(int frames);  // take a snapshot every 'frames' frames
+    void clear();
+
+    // Call once per emulated frame
+    void capture(Bus &bus);
+
+    // Load the state about 'frames' frames back (rounded up to whole snapshots,
+    // limited to what is stored). Returns the number of frames actually rewound.
+    int rewind(Bus &bus, int frames);
+
+    int frames_available() const { return int(entries.size()) * interval; }
+    int memory_used() const { return used; } // bytes taken by deltas
+
+private:
+    struct Entry
+    {
+        int offset; // in ring
+        int size;
+    };
+
+    int budget;
+    int interval;
+    int frame_count; // frames since last snapshot
+
+    QByteArray ring;   // delta storage, grows up to 'budget'
+    int head;          // where next delta goes
+    int used;          // bytes taken by entries
+    std::deque<Entry> entries; // oldest first
+
+    QByteArray last;    // newest snapshot, padded to whole words
+    int last_size;      // its real size, 0 if none
+    QByteArray current; // scratch for the snapshot being taken
+    QByteArray delta;   // scratch for encoding
+
+    int alloc(int size);
+    void drop_oldest();
+};
+
+#endif // REWIND_H
@@ -0,0 +1,155 @@
+#include "runahead.h"
+#include "bus.h"
+#include "movie.h"
+#include <QElapsedTimer>
+#include <cstring>
+
+RunAhead::RunAhead()
+    : ahead_frames(0), overhead(0), ahead(nullptr), movie(nullptr), job_ready(false), job_done(false),
+      quit(false)
+{}
+
+RunAhead::~RunAhead()
+{
+    stop_worker();
+    delete ahead;
+}
+
+void RunAhead::set_frames(int n)
+{
+    ahead_frames = qMax(n, 0);
+    overhead = 0;
+}
+
+bool RunAhead::set_second_instance(const QString &rom_path)
+{
+    stop_worker();
+    delete ahead;
+    ahead = nullptr;
+    overhead = 0;
+    if (rom_path.isEmpty())
+        return true;
+
+    Bus *console = new Bus;
+    if (!console->cartridge.read_from_file(rom_path)) {
+        delete console;
+        return false;
+    }
+    console->reset();
+    console->Apu.suppress_output(true); // never heard
+    console->controller_left.set_latch_hook(latch, this, 0);
+    console->controller_right.set_latch_hook(latch, this, 1);
+    ahead = console;
+
+    quit = false;
+    job_ready = false;
+    job_done = false;
+    worker = std::thread(&RunAhead::worker_loop, this);
+    return true;
+}
+
+void RunAhead::stop_worker()
+{
+    if (!worker.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void RunAhead::worker_loop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [this] { return job_ready || quit; });
+        if (quit)
+            return;
+        job_ready = false;
+        guard.unlock();
+
+        // 'state' is the real console before its current frame
+        ahead->load_state(state);
+        run_ahead(*ahead, true);
+
+        guard.lock();
+        job_done = true;
+        wake.notify_all();
+    }
+}
+
+// The second instance's controllers: the frames ahead of a movie have their
+// buttons in it already
+quint8 RunAhead::latch(void *user_data, int port, quint8 buttons)
+{
+    RunAhead *self = static_cast<RunAhead *>(user_data);
+    return self->movie ? self->movie->buttons(self->ahead->frame_number(), port, buttons) : buttons;
+}
+
+// Run the frames ahead on 'console', showing only the last one. If
+// 'rerun_real_frame', the real frame is run first (on a second instance).
+void RunAhead::run_ahead(Bus &console, bool rerun_real_frame)
+{
+    if (rerun_real_frame) {
+        console.Ppu.video_output = false;
+        console.run_frame();
+    }
+    for (int i = 1; i <= ahead_frames; i++) {
+        console.Ppu.video_output = (i == ahead_frames);
+        console.run_frame();
+    }
+    console.Ppu.video_output = true;
+}
+
+const Bus &RunAhead::run_frame(Bus &bus)
+{
+    if (ahead_frames == 0) {
+        bus.run_frame();
+        return bus;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 real_frame_ns;
+    const Bus *shown = &bus;
+
+    if (ahead) {
+        bus.save_state(state);
+        memcpy(ahead->controller_left.cur_keystate, bus.controller_left.cur_keystate,
+               sizeof(bus.controller_left.cur_keystate));
+        memcpy(ahead->controller_right.cur_keystate, bus.controller_right.cur_keystate,
+               sizeof(bus.controller_right.cur_keystate));
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            job_ready = true;
+        }
+        wake.notify_all();
+
+        qint64 start = timer.nsecsElapsed();
+        bus.Ppu.video_output = false;
+        bus.run_frame();
+        bus.Ppu.video_output = true;
+        real_frame_ns = timer.nsecsElapsed() - start;
+
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this] { return job_done; });
+        job_done = false;
+        shown = ahead;
+    } else {
+        bus.Ppu.video_output = false;
+        bus.run_frame();
+        real_frame_ns = timer.nsecsElapsed();
+
+        bus.save_state(state);
+        bus.Apu.suppress_output(true);
+        run_ahead(bus, false);
+        bus.Apu.suppress_output(false);
+        bus.load_state(state); // frame_data isn't part of the state, it keeps the picture ahead
+    }
+
+    double extra_ms = (timer.nsecsElapsed() - real_frame_ns) / 1e6;
+    overhead += (extra_ms - overhead) * 0.1;
+    return *shown;
+}
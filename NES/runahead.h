@@ -0,0 +1,67 @@
+#ifndef RUNAHEAD_H
+#define RUNAHEAD_H
+
+#include <QByteArray>
+#include <QString>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class Bus;
+class Movie;
+
+// Run-ahead hides the input lag games have on their own. Each host frame the
+// console runs its real frame, then runs 'frames' more with the same input,
+// silent and drawing only the last one, and that picture is shown. The console
+// is then put back to the end of the real frame through a savestate.
+//
+// With a second instance, the frames ahead are run by another console on a
+// worker thread at the same time as the real frame, so the real console is
+// never rolled back and its sound is never interrupted.
+class RunAhead
+{
+public:
+    RunAhead();
+    ~RunAhead();
+
+    void set_frames(int n); // 0 turns run-ahead off
+    int frames() const { return ahead_frames; }
+
+    // Use a second console for the frames ahead, loading the ROM from
+    // 'rom_path'. An empty path goes back to rolling back the real console.
+    bool set_second_instance(const QString &rom_path);
+    bool second_instance() const { return ahead != nullptr; }
+
+    // The movie the real console may be playing. The second instance gets
+    // its buttons from it, as the real console will, instead of the keys.
+    void set_movie(const Movie *playing) { movie = playing; }
+
+    // Emulate one host frame on 'bus'. Returns the console whose
+    // Ppu.frame_data holds the picture to show.
+    const Bus &run_frame(Bus &bus);
+
+    // Time spent per frame on top of the real frame, averaged over recent frames
+    double overhead_ms() const { return overhead; }
+
+private:
+    int ahead_frames;
+    double overhead;
+    QByteArray state;
+
+    // second instance
+    Bus *ahead;
+    const Movie *movie;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool job_ready;
+    bool job_done;
+    bool quit;
+
+    void stop_worker();
+    void worker_loop();
+    void run_ahead(Bus &console, bool rerun_real_frame);
+    static quint8 latch(void *user_data, int port, quint8 buttons);
+};
+
+#endif // RUNAHEAD_H
@@ -0,0 +1,196 @@
+#include "savestate.h"
+#include <cstring>
+
+static const char state_magic[4] = {'N', 'E', 'S', 'S'};
+
+StateIO::StateIO(QByteArray &out)
+    : out(&out), raw_out(nullptr), in(nullptr), in_size(0), pos(header_size), chunk_pos(-1),
+      chunk_end(0), loading(false), failed(false), raw(false)
+{
+    // reserve() keeps the buffer allocated across saves, so repeated saves don't touch the heap
+    if (out.capacity() < 0x4000)
+        out.reserve(0x4000);
+    out.resize(header_size);
+    memcpy(out.data(), state_magic, 4);
+    write_u32(4, version);
+}
+
+StateIO::StateIO(const char *data, int size)
+    : out(nullptr), raw_out(nullptr), in(data), in_size(size), pos(header_size), chunk_pos(-1),
+      chunk_end(0), loading(true), failed(false), raw(false)
+{
+    if (size < header_size || memcmp(data, state_magic, 4) != 0 || read_u32(4) != version)
+        failed = true;
+}
+
+StateIO StateIO::raw_writer(char *data, int capacity)
+{
+    StateIO io;
+    io.out = nullptr;
+    io.raw_out = data;
+    io.in = nullptr;
+    io.in_size = capacity;
+    io.pos = 0;
+    io.chunk_pos = -1;
+    io.chunk_end = capacity;
+    io.loading = false;
+    io.failed = false;
+    io.raw = true;
+    return io;
+}
+
+StateIO StateIO::raw_reader(const char *data, int size)
+{
+    StateIO io = raw_writer(nullptr, size);
+    io.in = data;
+    io.loading = true;
+    return io;
+}
+
+quint32 StateIO::read_u32(int offset) const
+{
+    quint32 value;
+    memcpy(&value, in + offset, 4);
+    return value;
+}
+
+void StateIO::write_u32(int offset, quint32 value)
+{
+    memcpy(out->data() + offset, &value, 4);
+}
+
+bool StateIO::begin_chunk(quint32 tag)
+{
+    Q_ASSERT(chunk_pos < 0); // chunks don't nest
+
+    if (raw) {
+        chunk_pos = pos;
+        return !failed;
+    }
+
+    if (!loading) {
+        chunk_pos = pos;
+        pos += chunk_header_size;
+        out->resize(pos);
+        write_u32(chunk_pos, tag);
+        return true;
+    }
+
+    if (failed)
+        return false;
+
+    // Chunks are normally read in the order they were written, so look from
+    // the current position first, then from the start
+    int start = pos;
+    for (int pass = 0; pass < 2; pass++) {
+        int p = pass ? header_size : start;
+        while (p + chunk_header_size <= in_size) {
+            quint32 size = read_u32(p + 4);
+            if (size > quint32(in_size - p - chunk_header_size)) {
+                failed = true; // truncated
+                return false;
+            }
+            if (read_u32(p) == tag) {
+                chunk_pos = p;
+                pos = p + chunk_header_size;
+                chunk_end = pos + int(size);
+                return true;
+            }
+            p += chunk_header_size + int(size);
+        }
+    }
+    failed = true;
+    return false;
+}
+
+void StateIO::end_chunk()
+{
+    Q_ASSERT(chunk_pos >= 0 || failed); // a load that failed carries on as a no-op
+
+    if (raw) {
+        // no header to fill in, nothing to skip
+    } else if (loading) {
+        pos = chunk_end; // skip fields added by newer versions
+    } else {
+        write_u32(chunk_pos + 4, quint32(pos - chunk_pos - chunk_header_size));
+    }
+    chunk_pos = -1;
+}
+
+void StateIO::block(void *data, quint32 size)
+{
+    Q_ASSERT(chunk_pos >= 0 || failed); // a load that failed carries on as a no-op
+
+    if (raw) {
+        if (failed || size > quint32(chunk_end - pos)) {
+            failed = true;
+        } else if (loading) {
+            memcpy(data, in + pos, size);
+        } else if (raw_out) {
+            memcpy(raw_out + pos, data, size);
+        }
+        pos += int(size);
+        return;
+    }
+
+    if (!loading) {
+        out->resize(pos + int(size));
+        memcpy(out->data() + pos, data, size);
+        pos += int(size);
+        return;
+    }
+
+    if (failed || size > quint32(chunk_end - pos)) {
+        failed = true;
+        return;
+    }
+    memcpy(data, in + pos, size);
+    pos += int(size);
+}
+
+static const quint64 prime1 = 0x9E3779B185EBCA87ull;
+static const quint64 prime2 = 0xC2B2AE3D27D4EB4Full;
+static const quint64 prime3 = 0x165667B19E3779F9ull;
+
+static inline quint64 rotl64(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 mix_lane(quint64 acc, quint64 value)
+{
+    return rotl64(acc + value * prime2, 31) * prime1;
+}
+
+quint64 hash_state(const char *data, int size)
+{
+    quint64 lanes[4] = {prime1 + prime2, prime2, 0, 0 - prime1};
+    const char *p = data;
+    const char *end = data + size;
+
+    for (; end - p >= 32; p += 32) {
+        for (int i = 0; i < 4; i++) {
+            quint64 value;
+            memcpy(&value, p + i * 8, 8);
+            lanes[i] = mix_lane(lanes[i], value);
+        }
+    }
+
+    quint64 h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+    h += quint64(size);
+    for (; end - p >= 8; p += 8) {
+        quint64 value;
+        memcpy(&value, p, 8);
+        h = rotl64(h ^ mix_lane(0, value), 27) * prime1 + prime3;
+    }
+    for (; p < end; p++)
+        h = rotl64(h ^ (quint8(*p) * prime3), 11) * prime1;
+
+    // final avalanche
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
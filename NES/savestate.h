@@ -0,0 +1,71 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <QByteArray>
+#include <QtGlobal>
+
+// Savestate format:
+//   header: magic "NESS", quint32 version
+//   chunks: quint32 tag, quint32 size, then 'size' bytes of payload
+// Each component writes its fields into its own chunk as raw bytes (native
+// byte order), so saving and loading is mostly memcpy. Chunks a reader does
+// not know about are skipped; a missing chunk or field fails the load.
+
+#define STATE_TAG(a, b, c, d) \
+    (quint32(quint8(a)) | quint32(quint8(b)) << 8 | quint32(quint8(c)) << 16 | quint32(quint8(d)) << 24)
+
+class StateIO
+{
+public:
+    enum { version = 2 };
+    enum { header_size = 8, chunk_header_size = 8 };
+
+    explicit StateIO(QByteArray &out);   // save into 'out', reusing its capacity
+    StateIO(const char *data, int size); // load from 'data'
+
+    // Raw states are the fields back to back in caller memory, with no header,
+    // chunks or checks: only for copies within one process (Bus::clone).
+    // A writer on nullptr just counts the bytes, see size().
+    static StateIO raw_writer(char *data, int capacity);
+    static StateIO raw_reader(const char *data, int size);
+    int size() const { return pos; }
+
+    bool is_loading() const { return loading; }
+    bool ok() const { return !failed; }
+
+    // Start a component's chunk. When loading, returns false if the state has none.
+    bool begin_chunk(quint32 tag);
+    void end_chunk();
+
+    // Copy 'size' bytes to or from the current chunk
+    void block(void *data, quint32 size);
+
+    template<typename T>
+    void pod(T &value)
+    {
+        block(&value, sizeof(T));
+    }
+
+private:
+    StateIO() {}
+
+    QByteArray *out;
+    char *raw_out;
+    const char *in;
+    int in_size;
+    int pos;       // current offset in the state
+    int chunk_pos; // offset of current chunk's header, -1 if none
+    int chunk_end; // end of current chunk's payload when loading
+    bool loading;
+    bool failed;
+    bool raw;
+
+    quint32 read_u32(int offset) const;
+    void write_u32(int offset, quint32 value);
+};
+
+// 64-bit hash of a savestate, to compare runs frame by frame. Four
+// independent lanes over 32 bytes at a time keep it memory bound.
+quint64 hash_state(const char *data, int size);
+
+#endif // SAVESTATE_H
@@ -0,0 +1,43 @@
+#include "snapshotpool.h"
+#include "bus.h"
+
+SnapshotPool::SnapshotPool(Bus &model, int count) : slot_count(count)
+{
+    // keep slots 8-byte aligned
+    size = (model.snapshot_size() + 7) & ~7;
+    memory.resize(size_t(size) * count);
+    free_slots.reserve(count);
+    clear();
+}
+
+int SnapshotPool::save(Bus &bus)
+{
+    if (free_slots.empty())
+        return -1;
+    int slot = free_slots.back();
+    free_slots.pop_back();
+    save(bus, slot);
+    return slot;
+}
+
+void SnapshotPool::save(Bus &bus, int slot)
+{
+    bus.clone(memory.data() + size_t(slot) * size);
+}
+
+void SnapshotPool::restore(Bus &bus, int slot) const
+{
+    bus.restore_from(data(slot));
+}
+
+void SnapshotPool::release(int slot)
+{
+    free_slots.push_back(slot);
+}
+
+void SnapshotPool::clear()
+{
+    free_slots.clear();
+    for (int slot = capacity() - 1; slot >= 0; slot--)
+        free_slots.push_back(slot);
+}
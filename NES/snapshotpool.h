@@ -0,0 +1,37 @@
+#ifndef SNAPSHOTPOOL_H
+#define SNAPSHOTPOOL_H
+
+#include <cstddef>
+#include <vector>
+
+class Bus;
+
+// Fixed number of console snapshots in one preallocated block, for search
+// that forks a state thousands of times a second. Slots are sized for the
+// game in the console given to the constructor; every console saved or
+// restored must be playing that game. Not thread safe: one pool per thread.
+class SnapshotPool
+{
+public:
+    SnapshotPool(Bus &model, int count);
+
+    int capacity() const { return slot_count; }
+    int used() const { return capacity() - int(free_slots.size()); }
+    int slot_size() const { return size; }
+
+    int save(Bus &bus);            // clone into a free slot and return it, -1 when full
+    void save(Bus &bus, int slot); // write a given slot, for callers that pick slots themselves
+    void restore(Bus &bus, int slot) const;
+    void release(int slot);
+    void clear(); // release every slot
+
+    const char *data(int slot) const { return memory.data() + size_t(slot) * size; }
+
+private:
+    int size;
+    int slot_count;
+    std::vector<char> memory;
+    std::vector<int> free_slots;
+};
+
+#endif // SNAPSHOTPOOL_H
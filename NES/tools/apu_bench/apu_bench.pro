@@ -0,0 +1,19 @@
+# APU microbenchmark: times Blip_Buffer synthesis and read-out at every SIMD
+# level the host CPU supports and checks that all levels give identical output.
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle qt
+
+QMAKE_CXXFLAGS_RELEASE += -O3
+
+# time the vector read-out kernels too, which the emulator leaves off
+DEFINES += BLIP_SIMD_READ=1
+
+SOURCES += \
+    main.cpp \
+    ../../nes_apu/Blip_Buffer.cpp \
+    ../../nes_apu/Blip_Simd.cpp \
+    ../../nes_apu/Nes_Apu.cpp \
+    ../../nes_apu/Nes_Oscs.cpp \
+    ../../nes_apu/apu_snapshot.cpp
@@ -0,0 +1,185 @@
+// APU microbenchmark
+//
+// Drives Nes_Apu with a fixed pseudo-random register stream and a dense
+// Blip_Synth workload, once per SIMD level, and reports the time spent in
+// synthesis and in read_samples(). Exits non-zero if any level's output
+// differs from the scalar path.
+
+#include "../../nes_apu/Nes_Apu.h"
+#include "../../nes_apu/Blip_Buffer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const long sample_rate = 44100;
+const long clock_rate = 1789773;
+const int frame_length = 29780;
+
+struct Rng
+{
+    unsigned state;
+    explicit Rng(unsigned seed) : state(seed) {}
+    unsigned next() { state = state * 1664525u + 1013904223u; return state >> 8; }
+};
+
+int dmc_read(void *user_data, cpu_addr_t addr)
+{
+    return (addr * 0x3D + *(unsigned *)user_data) & 0xFF;
+}
+
+struct Result
+{
+    double synth_ms = 0;
+    double read_ms = 0;
+    unsigned long long hash = 1469598103934665603ull;
+    long samples = 0;
+
+    void add(const blip_sample_t *p, long n)
+    {
+        const unsigned char *b = (const unsigned char *)p;
+        for (long i = 0; i < n * (long)sizeof *p; i++)
+            hash = (hash ^ b[i]) * 1099511628211ull;
+        samples += n;
+    }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double ms_since(Clock::time_point t0)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// Full APU: every channel busy, writes spread across the frame
+Result run_apu(int level, int frames, bool stereo)
+{
+    Result r;
+    Blip_Buffer buf;
+    buf.simd_level(level);
+    if (buf.sample_rate(sample_rate, 1000 / 30))
+        abort();
+    buf.clock_rate(clock_rate);
+
+    unsigned dmc_seed = 0x1234;
+    Nes_Apu apu;
+    apu.output(&buf);
+    apu.dmc_reader(dmc_read, &dmc_seed);
+    apu.write_register(0, 0x4015, 0x1F);
+
+    Rng rng(12345);
+    std::vector<blip_sample_t> out(stereo ? 4096 : 2048);
+    for (int f = 0; f < frames; f++)
+    {
+        Clock::time_point t0 = Clock::now();
+        for (cpu_time_t t = 0; t < frame_length; t += 64 + rng.next() % 512)
+        {
+            cpu_addr_t reg = 0x4000 + rng.next() % 0x14;
+            if ((reg & 3) == 1 && reg < 0x4010)
+                continue; // leave sweep units alone so channels stay audible
+            apu.write_register(t, reg, rng.next() & 0xFF);
+            if (rng.next() % 8 == 0)
+                apu.write_register(t, 0x4015, 0x1F);
+        }
+        apu.end_frame(frame_length);
+        buf.end_frame(frame_length);
+        r.synth_ms += ms_since(t0);
+
+        t0 = Clock::now();
+        long n = buf.read_samples(out.data(), 2048, stereo);
+        r.read_ms += ms_since(t0);
+        r.add(out.data(), stereo ? n * 2 : n);
+    }
+    return r;
+}
+
+// Wide impulses in fine mode, the heaviest Blip_Synth configurations
+template<int quality, int range>
+Result run_synth(int level, int frames)
+{
+    Result r;
+    Blip_Buffer buf;
+    buf.simd_level(level);
+    if (buf.sample_rate(sample_rate, 1000 / 30))
+        abort();
+    buf.clock_rate(clock_rate);
+    Blip_Synth<quality, range> synth;
+    synth.volume(0.5);
+    synth.output(&buf);
+
+    Rng rng(777);
+    int amp = 0;
+    std::vector<blip_sample_t> out(2048);
+    for (int f = 0; f < frames; f++)
+    {
+        Clock::time_point t0 = Clock::now();
+        for (blip_time_t t = 0; t < frame_length; t += 1 + rng.next() % 24)
+        {
+            int a = (int)(rng.next() % (2 * (range < 0 ? -range : range))) - (range < 0 ? -range : range);
+            synth.offset(t, a - amp);
+            amp = a;
+        }
+        buf.end_frame(frame_length);
+        r.synth_ms += ms_since(t0);
+
+        t0 = Clock::now();
+        long n = buf.read_samples(out.data(), 2048);
+        r.read_ms += ms_since(t0);
+        r.add(out.data(), n);
+    }
+    return r;
+}
+
+const char *level_name(int level)
+{
+    return blip_kernels(level)->name;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 3000;
+    if (frames <= 0)
+        frames = 3000;
+
+    int top = blip_simd_supported();
+    printf("frames per run: %d, best SIMD level: %s\n\n", frames, level_name(top));
+
+    struct Case
+    {
+        const char *name;
+        Result (*run)(int, int);
+    };
+    static const Case cases[] = {
+        {"apu mono", [](int l, int f) { return run_apu(l, f, false); }},
+        {"apu stereo", [](int l, int f) { return run_apu(l, f, true); }},
+        {"synth q3 r15", [](int l, int f) { return run_synth<blip_good_quality, 15>(l, f); }},
+        {"synth q4 fine", [](int l, int f) { return run_synth<blip_high_quality, -255>(l, f); }},
+        {"synth q5 fine", [](int l, int f) { return run_synth<5, 4095>(l, f); }},
+    };
+
+    bool exact = true;
+    printf("%-14s %-7s %10s %10s %18s\n", "case", "level", "synth ms", "read ms", "output hash");
+    for (const Case &c : cases)
+    {
+        Result base;
+        for (int level = blip_simd_scalar; level <= top; level++)
+        {
+            Result r = c.run(level, frames);
+            if (level == blip_simd_scalar)
+                base = r;
+            bool same = r.hash == base.hash && r.samples == base.samples;
+            exact = exact && same;
+            printf("%-14s %-7s %10.2f %10.2f   %016llx%s\n", c.name, level_name(level),
+                   r.synth_ms, r.read_ms, r.hash, same ? "" : "  MISMATCH");
+        }
+    }
+
+    printf("\n%s\n", exact ? "all levels bit-exact" : "SIMD output differs from scalar");
+    return exact ? 0 : 1;
+}
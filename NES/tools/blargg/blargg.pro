@@ -0,0 +1,19 @@
+# Accuracy check: runs the test ROMs in Data/Test (blargg's APU and PPU
+# tests, nestest) without a window and prints pass/fail for each.
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+# QZipReader reads the archives
+QT += gui-private
+
+QMAKE_CXXFLAGS_RELEASE += -O3
+
+# default location of the test ROMs
+DEFINES += BLARGG_SOURCE_DIR=\\\"$$PWD\\\"
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,294 @@
+// Test ROM runner
+//
+// usage: blargg [--timeout SECONDS] [--jobs N] [--verbose] [PATH]...
+//
+// Runs every test ROM found in PATH (.nes files, .zip archives or
+// directories searched recursively; Data/Test by default) and prints
+// PASS/FAIL for each. The ROMs run in parallel, one thread per core, and
+// each stops when it reports a result or after SECONDS of emulated time.
+// Exits non-zero if any test didn't pass.
+//
+// Results are read the way each kind of ROM reports them:
+//  - newer blargg tests write 0xDE 0xB0 0x61 at 0x6001, their status at 0x6000
+//    (0x80 running, 0x81 wants a reset, below 0x80 the result, 0 passed) and
+//    their text from 0x6004, all in the cartridge RAM
+//  - the 2005 PPU tests keep the result at 0xF0 (1 passed) and end in a
+//    JMP to itself
+//  - nestest runs in its automatic mode from 0xC000 and leaves error
+//    codes at 0x02 and 0x03 (both 0 passed)
+
+#include "bus.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QtGui/private/qzipreader_p.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifndef BLARGG_SOURCE_DIR
+#define BLARGG_SOURCE_DIR "."
+#endif
+
+namespace {
+
+enum Outcome { Passed, Failed, TimedOut };
+
+struct Test
+{
+    QString name;
+    Bus *nes;
+    bool nestest;
+
+    Outcome outcome;
+    int code;
+    QString text;
+    int frames;
+};
+
+const int frames_per_second = 60;
+
+// Result area written by newer blargg tests
+bool has_status(const Mapper *mapper)
+{
+    return mapper->addram_size >= 0x100 && mapper->addram[1] == 0xDE && mapper->addram[2] == 0xB0 && mapper->addram[3] == 0x61;
+}
+
+QString status_text(const Mapper *mapper)
+{
+    const char *text = (const char *) mapper->addram + 4;
+    return QString::fromLatin1(text, int(strnlen(text, mapper->addram_size - 4))).trimmed();
+}
+
+// The CPU is between instructions at the end of a frame, so a JMP to itself
+// shows at reg_pc. Tests waiting for NMI loop the same way, with NMI on.
+bool stuck(Bus &nes)
+{
+    quint16 pc = nes.Cpu.reg_pc;
+    if (nes.Ppu.nmi_enabled())
+        return false;
+    if (pc < 0x8000 || nes.load(pc) != 0x4C)
+        return false;
+    return (nes.load(pc + 1) | nes.load(pc + 2) << 8) == pc;
+}
+
+void run_nestest(Test &t, int timeout)
+{
+    Bus &nes = *t.nes;
+    nes.Cpu.reg_pc = 0xC000;
+    nes.Cpu.cycles_wait = 0;
+    quint64 limit = quint64(timeout) * 1789773;
+    bool undocumented = false;
+    // the automatic mode ends with an RTS at 0xC66E, with nothing to return to
+    while (nes.cpu_time() < limit) {
+        if (nes.Cpu.cycles_wait == 0) {
+            if (nes.Cpu.reg_pc == 0xC66E)
+                break;
+            // the CPU gives up on opcodes it doesn't know, so stop before one
+            if (!nes.Cpu.is_documented(nes.load(nes.Cpu.reg_pc))) {
+                undocumented = true;
+                break;
+            }
+        }
+        nes.clock();
+    }
+
+    t.frames = int(nes.cpu_time() / 29781);
+    if (nes.cpu_time() >= limit) {
+        t.outcome = TimedOut;
+        return;
+    }
+    t.code = nes.ram_data[0x02] << 8 | nes.ram_data[0x03];
+    t.outcome = t.code == 0 && !undocumented ? Passed : Failed;
+    t.text = QString("official opcodes: %1, unofficial opcodes: %2")
+                 .arg(nes.ram_data[0x02], 2, 16, QChar('0'))
+                 .arg(nes.ram_data[0x03], 2, 16, QChar('0'));
+    if (undocumented)
+        t.text += QString(", stopped at unsupported opcode %1 at %2")
+                      .arg(nes.load(nes.Cpu.reg_pc), 2, 16, QChar('0'))
+                      .arg(nes.Cpu.reg_pc, 4, 16, QChar('0'));
+}
+
+void run_test(Test &t, int timeout)
+{
+    if (t.nestest) {
+        run_nestest(t, timeout);
+        return;
+    }
+
+    Bus &nes = *t.nes;
+    const Mapper *mapper = nes.cartridge.mapper_ptr;
+    int reset_at = -1;
+    t.outcome = TimedOut;
+    for (t.frames = 0; t.frames < timeout * frames_per_second; t.frames++) {
+        nes.run_frame();
+
+        if (has_status(mapper)) {
+            quint8 status = mapper->addram[0];
+            if (status == 0x81 && reset_at < 0) {
+                reset_at = t.frames + 6; // press reset 100 ms later
+            } else if (status < 0x80) {
+                t.code = status;
+                t.text = status_text(mapper);
+                t.outcome = status == 0 ? Passed : Failed;
+                return;
+            }
+            if (reset_at == t.frames) {
+                nes.soft_reset();
+                reset_at = -1;
+            }
+        } else if (stuck(nes)) {
+            t.code = nes.ram_data[0xF0];
+            t.outcome = t.code == 1 ? Passed : Failed;
+            return;
+        }
+    }
+}
+
+void add_rom(std::vector<Test> &tests, const QString &name, const QString &path)
+{
+    Test t;
+    t.name = name;
+    t.nes = new Bus;
+    QString error;
+    if (!t.nes->cartridge.read_from_file(path, &error)) {
+        fprintf(stderr, "can't load %s: %s\n", qPrintable(name), qPrintable(error));
+        delete t.nes;
+        return;
+    }
+    t.nes->reset();
+    t.nes->Apu.suppress_output(true);
+    t.nestest = QFileInfo(name).fileName().toLower() == "nestest.nes";
+    t.outcome = TimedOut;
+    t.code = -1;
+    t.frames = 0;
+    tests.push_back(t);
+}
+
+// The core loads ROMs from files, so the archived ones are unpacked into 'temp'
+void add_zip(std::vector<Test> &tests, const QString &zip_path, const QTemporaryDir &temp)
+{
+    QZipReader zip(zip_path);
+    if (!zip.isReadable()) {
+        fprintf(stderr, "can't read %s\n", qPrintable(zip_path));
+        return;
+    }
+    for (const QZipReader::FileInfo &info : zip.fileInfoList()) {
+        if (!info.isFile || !info.filePath.toLower().endsWith(".nes"))
+            continue;
+        QString unpacked = temp.path() + "/" + QString::number(tests.size()) + ".nes";
+        QFile file(unpacked);
+        QByteArray data = zip.fileData(info.filePath);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+            fprintf(stderr, "can't unpack %s\n", qPrintable(info.filePath));
+            continue;
+        }
+        file.close();
+        add_rom(tests, QFileInfo(zip_path).fileName() + ":" + info.filePath, unpacked);
+    }
+}
+
+void add_path(std::vector<Test> &tests, const QString &path, const QTemporaryDir &temp)
+{
+    QFileInfo info(path);
+    if (info.isDir()) {
+        QStringList files;
+        QDirIterator it(path, QStringList{"*.nes", "*.zip"}, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+            files << it.next();
+        files.sort();
+        for (const QString &file : files)
+            add_path(tests, file, temp);
+    } else if (path.toLower().endsWith(".zip")) {
+        add_zip(tests, path, temp);
+    } else {
+        add_rom(tests, info.fileName(), path);
+    }
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: blargg [--timeout SECONDS] [--jobs N] [--verbose] [PATH]...\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QStringList paths;
+    int timeout = 30;
+    int jobs = int(std::thread::hardware_concurrency());
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--timeout") && has_value)
+            timeout = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--jobs") && has_value)
+            jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--verbose"))
+            verbose = true;
+        else if (argv[i][0] != '-')
+            paths << argv[i];
+        else
+            return usage();
+    }
+    if (paths.isEmpty())
+        paths << BLARGG_SOURCE_DIR "/../../../Data/Test";
+    jobs = qMax(jobs, 1);
+
+    QTemporaryDir temp;
+    if (!temp.isValid()) {
+        fprintf(stderr, "can't create a temporary directory\n");
+        return 1;
+    }
+
+    // Load every ROM here: the core may show a message box, which only this thread can do
+    std::vector<Test> tests;
+    for (const QString &path : paths)
+        add_path(tests, path, temp);
+    if (tests.empty()) {
+        fprintf(stderr, "no test ROMs found\n");
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < qMin(jobs, int(tests.size())); t++) {
+        threads.emplace_back([&] {
+            for (size_t i; (i = next++) < tests.size();)
+                run_test(tests[i], timeout);
+        });
+    }
+    for (std::thread &t : threads)
+        t.join();
+
+    int passed = 0;
+    for (Test &t : tests) {
+        static const char *const labels[] = {"PASS   ", "FAIL   ", "TIMEOUT"};
+        printf("%s %s", labels[t.outcome], qPrintable(t.name));
+        if (t.outcome == Failed)
+            printf(" (code %d)", t.code);
+        printf(", %.1f s\n", double(t.frames) / frames_per_second);
+        if (!t.text.isEmpty() && (verbose || t.outcome != Passed))
+            printf("        %s\n", qPrintable(QString(t.text).replace("\n", "\n        ")));
+        passed += t.outcome == Passed;
+        delete t.nes;
+    }
+    printf("%d of %d passed, %.1f s\n", passed, int(tests.size()), timer.nsecsElapsed() / 1e9);
+    return passed == int(tests.size()) ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+# Golden-frame check: plays scripted input into every ROM under Data/Mapper*
+# and compares frame hashes at checkpoints with the values in golden.txt.
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT -= gui
+
+QMAKE_CXXFLAGS_RELEASE += -O3
+
+# default locations of the ROMs and of golden.txt
+DEFINES += GOLDEN_SOURCE_DIR=\\\"$$PWD\\\"
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,332 @@
+// Golden-frame check
+//
+// usage: golden [--data DIR] [--golden FILE] [--frames N] [--jobs N]
+//               [--images DIR] [--update]
+//
+// Plays scripted input into every ROM under DIR/Mapper*/ from power-on (the
+// presses that get the game through its menus, then the same random pads
+// for all), hashes the picture every 300 frames, and compares the hashes
+// with FILE. ROMs are spread over N threads (all cores by default). Exits
+// non-zero if any hash differs, or if a ROM shows the same picture at two
+// checkpoints in a row: the input has left it stuck, and its later hashes
+// would check nothing.
+//
+// The hash is of the NES color (0-63) of every pixel as the PPU draws it,
+// through an Observation, so it doesn't depend on the RGB palette.
+//
+// --update rewrites FILE with the hashes of this run instead; with --images
+// it also keeps each checkpoint's picture in DIR. When a check fails, the
+// picture is written next to FILE as .ppm, and if DIR holds the reference
+// picture a diff image (differing pixels in red) is written too.
+
+#include "bus.h"
+#include "observation.h"
+#include "savestate.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <vector>
+
+#ifndef GOLDEN_SOURCE_DIR
+#define GOLDEN_SOURCE_DIR "."
+#endif
+
+namespace {
+
+const int checkpoint_interval = 300;
+const int menu_frames = 600; // random pads after this
+
+// A button held for a few frames, to get through the menus
+struct Press
+{
+    int frame;
+    int key;
+};
+
+// One Start on the title screen takes most games into play. Pressing it
+// again would only pause them.
+const std::vector<Press> default_menu = {{400, FC_KEY_START}};
+
+// Games that need more: a Start that skips the intro first, and a name to
+// register in Zelda (one letter, Select down to END, Start, then Start on
+// the new file)
+const std::map<QString, std::vector<Press>> menus = {
+    {"Mapper1/Squirrel_Fight.nes", {{250, FC_KEY_START}, {400, FC_KEY_START}}},
+    {"Mapper1/ZeldaUS.nes",
+     {{250, FC_KEY_START}, {330, FC_KEY_START}, {400, FC_KEY_A}, {430, FC_KEY_SELECT},
+      {460, FC_KEY_SELECT}, {490, FC_KEY_SELECT}, {520, FC_KEY_START}, {570, FC_KEY_START}}},
+    {"Mapper4/Super_Mario_Bros_3(USA).nes", {{300, FC_KEY_START}, {400, FC_KEY_START}}},
+};
+
+struct Checkpoint
+{
+    int frame;
+    quint64 hash;
+    QByteArray picture; // PPM, kept only when it is needed
+};
+
+struct Job
+{
+    QString name; // path under the data directory
+    Bus *nes;
+    Observation *picture; // the whole picture as palette indexes
+    const std::vector<Press> *menu;
+    std::vector<Checkpoint> checkpoints;
+};
+
+// The game's menu presses, then random pads. Start and Select are left out
+// of those so the games don't pause or reset.
+void scripted_input(Bus &nes, const std::vector<Press> &menu, int frame, unsigned &seed)
+{
+    bool *keys = nes.controller_left.cur_keystate;
+    memset(keys, 0, 8 * sizeof(bool));
+    if (frame < menu_frames) {
+        for (const Press &p : menu)
+            keys[p.key] |= frame >= p.frame && frame < p.frame + 5;
+        return;
+    }
+    if (frame % 8 == 0)
+        seed = seed * 1664525u + 1013904223u;
+    keys[FC_KEY_A] = (seed >> 24) & 1;
+    keys[FC_KEY_B] = (seed >> 25) & 1;
+    keys[FC_KEY_RIGHT] = (seed >> 26) & 1;
+    keys[FC_KEY_LEFT] = !keys[FC_KEY_RIGHT] && ((seed >> 27) & 1);
+    keys[FC_KEY_UP] = (seed >> 28) & 1;
+    keys[FC_KEY_DOWN] = !keys[FC_KEY_UP] && ((seed >> 29) & 1);
+}
+
+QByteArray to_ppm(const PPU &ppu)
+{
+    QByteArray data("P6\n256 240\n255\n");
+    data.append((const char *) ppu.frame_data, sizeof(ppu.frame_data));
+    return data;
+}
+
+void run_job(Job &job, int frames, bool keep_pictures)
+{
+    Bus &nes = *job.nes;
+    unsigned seed = 0x2A;
+    for (int f = 0; f < frames;) {
+        scripted_input(nes, *job.menu, f, seed);
+        nes.run_frame();
+        if (++f % checkpoint_interval == 0) {
+            Checkpoint c;
+            c.frame = f;
+            c.hash = hash_state((const char *) job.picture->latest(), job.picture->frame_size());
+            if (keep_pictures)
+                c.picture = to_ppm(nes.Ppu);
+            job.checkpoints.push_back(c);
+        }
+    }
+}
+
+QString picture_name(const QString &rom, int frame)
+{
+    QString name = rom;
+    name.replace("/", "_");
+    return name + "." + QString::number(frame) + ".ppm";
+}
+
+bool write_file(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+// Differing pixels in red over a dimmed copy of the reference
+QByteArray diff_ppm(const QByteArray &expected, const QByteArray &actual)
+{
+    QByteArray diff = expected;
+    int header = expected.size() - 256 * 240 * 3;
+    if (header < 0 || actual.size() != expected.size())
+        return QByteArray();
+    for (int i = header; i < diff.size(); i += 3) {
+        if (memcmp(expected.constData() + i, actual.constData() + i, 3) != 0) {
+            diff[i] = char(255);
+            diff[i + 1] = 0;
+            diff[i + 2] = 0;
+        } else {
+            for (int c = 0; c < 3; c++)
+                diff[i + c] = char(quint8(expected[i + c]) / 4);
+        }
+    }
+    return diff;
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: golden [--data DIR] [--golden FILE] [--frames N] [--jobs N]\n"
+                    "              [--images DIR] [--update]\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QString data_dir = GOLDEN_SOURCE_DIR "/../../../Data";
+    QString golden_path = GOLDEN_SOURCE_DIR "/golden.txt";
+    QString image_dir;
+    int frames = 1200;
+    int jobs = int(std::thread::hardware_concurrency());
+    bool update = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--data") && has_value)
+            data_dir = argv[++i];
+        else if (!strcmp(argv[i], "--golden") && has_value)
+            golden_path = argv[++i];
+        else if (!strcmp(argv[i], "--frames") && has_value)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--jobs") && has_value)
+            jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--images") && has_value)
+            image_dir = argv[++i];
+        else if (!strcmp(argv[i], "--update"))
+            update = true;
+        else
+            return usage();
+    }
+    jobs = qMax(jobs, 1);
+
+    // golden.txt: "hash frame rom" per line, the ROM path last as it may hold spaces
+    std::map<QString, std::map<int, quint64>> golden;
+    if (!update) {
+        QFile file(golden_path);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            fprintf(stderr, "can't read %s, run with --update first\n", qPrintable(golden_path));
+            return 1;
+        }
+        QTextStream in(&file);
+        while (!in.atEnd()) {
+            QString line = in.readLine().trimmed();
+            if (line.isEmpty() || line.startsWith("#"))
+                continue;
+            QString hash = line.section(' ', 0, 0);
+            QString frame = line.section(' ', 1, 1);
+            golden[line.section(' ', 2)][frame.toInt()] = hash.toULongLong(nullptr, 16);
+        }
+    }
+
+    // Load every ROM first, so a bad one stops the run before any work
+    std::vector<Job> work;
+    QDir data(data_dir);
+    QStringList mappers = data.entryList(QStringList{"Mapper*"}, QDir::Dirs, QDir::Name);
+    for (const QString &mapper : mappers) {
+        QStringList roms = QDir(data.filePath(mapper)).entryList(QStringList{"*.nes"}, QDir::Files, QDir::Name);
+        for (const QString &rom : roms) {
+            Job job;
+            job.name = mapper + "/" + rom;
+            job.nes = new Bus;
+            QString error;
+            if (!job.nes->cartridge.read_from_file(data.filePath(job.name), &error)) {
+                fprintf(stderr, "can't load %s: %s\n", qPrintable(job.name), qPrintable(error));
+                return 1;
+            }
+            job.nes->reset();
+            job.nes->Apu.suppress_output(true);
+            ObservationFormat format;
+            format.kind = ObservationFormat::PaletteIndex;
+            job.picture = new Observation;
+            job.picture->set_format(format);
+            job.nes->Ppu.observation = job.picture;
+            auto menu = menus.find(job.name);
+            job.menu = menu != menus.end() ? &menu->second : &default_menu;
+            work.push_back(job);
+        }
+    }
+    if (work.empty()) {
+        fprintf(stderr, "no ROMs under %s/Mapper*\n", qPrintable(data_dir));
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    bool keep_pictures = !image_dir.isEmpty() || !update;
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < qMin(jobs, int(work.size())); t++) {
+        threads.emplace_back([&] {
+            for (size_t i; (i = next++) < work.size();)
+                run_job(work[i], frames, keep_pictures);
+        });
+    }
+    for (std::thread &t : threads)
+        t.join();
+    double seconds = timer.nsecsElapsed() / 1e9;
+
+    int failures = 0;
+    QByteArray updated("# golden-frame hashes, written by tools/golden --update\n");
+    QString out_dir = QFileInfo(golden_path).absolutePath();
+    for (Job &job : work) {
+        for (size_t i = 0; i < job.checkpoints.size(); i++) {
+            Checkpoint &c = job.checkpoints[i];
+            QString hash = QString("%1").arg(c.hash, 16, 16, QChar('0'));
+            if (i > 0 && job.checkpoints[i - 1].hash == c.hash) {
+                printf("STUCK   %s frame %d: same picture as frame %d\n", qPrintable(job.name), c.frame,
+                       job.checkpoints[i - 1].frame);
+                failures++;
+            }
+            if (update) {
+                updated += (hash + " " + QString::number(c.frame) + " " + job.name + "\n").toUtf8();
+                if (!image_dir.isEmpty())
+                    write_file(image_dir + "/" + picture_name(job.name, c.frame), c.picture);
+                continue;
+            }
+
+            auto rom = golden.find(job.name);
+            if (rom == golden.end() || !rom->second.count(c.frame)) {
+                printf("MISSING %s frame %d: %s\n", qPrintable(job.name), c.frame, qPrintable(hash));
+                failures++;
+                continue;
+            }
+            if (rom->second[c.frame] == c.hash)
+                continue;
+
+            failures++;
+            QString name = picture_name(job.name, c.frame);
+            printf("FAIL    %s frame %d: %s, expected %016llx\n", qPrintable(job.name), c.frame,
+                   qPrintable(hash), (unsigned long long) rom->second[c.frame]);
+            write_file(out_dir + "/" + name, c.picture);
+            if (!image_dir.isEmpty()) {
+                QFile reference(image_dir + "/" + name);
+                if (reference.open(QIODevice::ReadOnly)) {
+                    QByteArray diff = diff_ppm(reference.readAll(), c.picture);
+                    if (!diff.isEmpty())
+                        write_file(out_dir + "/diff." + name, diff);
+                }
+            }
+        }
+    }
+
+    if (update) {
+        if (failures) {
+            fprintf(stderr, "%s not updated: change the input so no ROM is stuck\n",
+                    qPrintable(golden_path));
+            return 1;
+        }
+        if (!write_file(golden_path, updated)) {
+            fprintf(stderr, "can't write %s\n", qPrintable(golden_path));
+            return 1;
+        }
+        printf("updated %s: %d ROMs, %d frames each, %.1f s\n", qPrintable(golden_path),
+               int(work.size()), frames, seconds);
+        return 0;
+    }
+    printf("%d ROMs, %d frames each, %d threads, %.1f s: %s\n", int(work.size()), frames,
+           qMin(jobs, int(work.size())), seconds, failures ? "FAILED" : "all frames match");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,15 @@
+# Headless runner: emulates a ROM without a window, as fast as it can, to
+# record or play back input movies and check that a run is reproducible.
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT -= gui
+
+QMAKE_CXXFLAGS_RELEASE += -O3
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp
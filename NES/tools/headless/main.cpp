@@ -0,0 +1,362 @@
+// Headless runner
+//
+// usage: headless ROM [--frames N] [--play MOVIE [--seek FRAME]... [--index]]
+//                     [--record MOVIE] [--random-input SEED] [--screenshot FILE.ppm]
+//                     [--hashes FILE] [--check-hashes FILE] [--envs N] [--runs N]
+//
+// Runs the ROM from power-on for N frames (or the length of the movie being
+// played) and prints hashes of the final state (Bus::state_hash, as --hashes
+// logs) and picture, so two runs of the same movie can be compared, and how
+// much of the CPU's time the game spent in wait loops (CPU::idle_cycles).
+// --record saves the input that was used, which is either nothing or random
+// buttons with --random-input.
+//
+// --seek jumps around the movie before running on from the last frame given,
+// timing each jump. --index reads the movie's savestate index from MOVIE.idx
+// if it's there and writes it back at the end.
+//
+// --hashes writes "frame hash" lines with the state hash after every frame.
+// --check-hashes compares each frame against such a file and stops at the
+// first frame that differs, to find where two runs part.
+//
+// --envs runs N more consoles in a VecEnv next to the first, with the same
+// input, and stops at the first frame where one of them differs from it. The
+// VecEnv draws every other frame and builds a downscaled, max-pooled gray
+// observation, which is checked against the same computed from frame_data.
+//
+// --runs plays the same frames N times from the start and prints the fps of
+// each run and their median, as a steadier measure of emulation speed than a
+// single run. Every run has to end in the same state.
+
+#include "bus.h"
+#include "movie.h"
+#include "savestate.h"
+#include "vecenv.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace {
+
+bool write_ppm(const QString &path, const PPU &ppu)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QByteArray data("P6\n256 240\n255\n");
+    data.append((const char *) ppu.frame_data, sizeof(ppu.frame_data));
+    return file.write(data) == data.size();
+}
+
+// What VecEnv is asked for with --envs: the picture without the top and
+// bottom 8 lines, 4x4 cells averaged, the brighter of two frames, two kept
+ObservationFormat check_format()
+{
+    ObservationFormat f;
+    f.kind = ObservationFormat::Gray;
+    f.crop_y = 8;
+    f.crop_height = 224;
+    f.scale = 4;
+    f.max_two_frames = true;
+    f.stack = 2;
+    return f;
+}
+
+// The same observation of a finished frame, from the RGB picture
+void gray_cells(const PPU &ppu, const ObservationFormat &f, quint8 *out)
+{
+    int width = f.crop_width / f.scale, height = f.crop_height / f.scale;
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            int sum = 0;
+            int top = f.crop_y + row * f.scale, left = f.crop_x + col * f.scale;
+            for (int y = 0; y < f.scale; y++) {
+                for (int x = 0; x < f.scale; x++) {
+                    const quint8 *rgb = ppu.frame_data[top + y][left + x];
+                    sum += (rgb[0] * 299 + rgb[1] * 587 + rgb[2] * 114 + 500) / 1000;
+                }
+            }
+            out[row * width + col] = quint8(sum / (f.scale * f.scale));
+        }
+    }
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: headless ROM [--frames N] [--play MOVIE [--seek FRAME]... [--index]]\n"
+                    "                    [--record MOVIE] [--random-input SEED] [--screenshot FILE.ppm]\n"
+                    "                    [--hashes FILE] [--check-hashes FILE] [--envs N] [--runs N]\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QString rom, play_path, record_path, screenshot, hash_path, check_path;
+    int frames = -1, env_count = 0, runs = 1;
+    bool random_input = false;
+    unsigned seed = 0;
+    std::vector<int> seeks;
+    bool use_index = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--frames") && has_value)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--play") && has_value)
+            play_path = argv[++i];
+        else if (!strcmp(argv[i], "--record") && has_value)
+            record_path = argv[++i];
+        else if (!strcmp(argv[i], "--random-input") && has_value) {
+            random_input = true;
+            seed = unsigned(strtoul(argv[++i], nullptr, 0));
+        } else if (!strcmp(argv[i], "--seek") && has_value)
+            seeks.push_back(atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--index"))
+            use_index = true;
+        else if (!strcmp(argv[i], "--screenshot") && has_value)
+            screenshot = argv[++i];
+        else if (!strcmp(argv[i], "--hashes") && has_value)
+            hash_path = argv[++i];
+        else if (!strcmp(argv[i], "--check-hashes") && has_value)
+            check_path = argv[++i];
+        else if (!strcmp(argv[i], "--envs") && has_value)
+            env_count = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--runs") && has_value)
+            runs = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && rom.isEmpty())
+            rom = argv[i];
+        else
+            return usage();
+    }
+    if (rom.isEmpty() || (!play_path.isEmpty() && !record_path.isEmpty())
+        || (play_path.isEmpty() && (!seeks.empty() || use_index))
+        || env_count < 0 || (env_count && !play_path.isEmpty()) || runs < 1
+        || (runs > 1 && (!record_path.isEmpty() || !seeks.empty() || env_count || !hash_path.isEmpty()
+                         || !check_path.isEmpty())))
+        return usage();
+
+    // the console is too big for the stack
+    static Bus nes;
+    QString error;
+    if (!nes.cartridge.read_from_file(rom, &error)) {
+        fprintf(stderr, "can't load %s: %s\n", qPrintable(rom), qPrintable(error));
+        return 1;
+    }
+    nes.Apu.suppress_output(true); // nobody listens
+
+    Movie movie;
+    if (!play_path.isEmpty()) {
+        if (!movie.load(play_path)) {
+            fprintf(stderr, "can't read %s\n", qPrintable(play_path));
+            return 1;
+        }
+        if (use_index && movie.load_index(play_path + ".idx"))
+            printf("index loaded\n");
+        if (!movie.play(nes)) {
+            fprintf(stderr, "can't play %s\n", qPrintable(play_path));
+            return 1;
+        }
+        if (frames < 0)
+            frames = movie.length();
+    } else if (!record_path.isEmpty()) {
+        movie.record(nes, true);
+    } else {
+        nes.reset();
+    }
+    if (frames < 0)
+        frames = 600;
+    const unsigned first_seed = seed;
+
+    QElapsedTimer timer;
+    int start = 0;
+    for (int target : seeks) {
+        timer.start();
+        if (!movie.seek(target)) {
+            fprintf(stderr, "can't seek to %d\n", target);
+            return 1;
+        }
+        start = movie.frame();
+        printf("seek %d  %.1f ms\n", start, timer.nsecsElapsed() / 1e6);
+    }
+
+    FILE *hash_out = nullptr, *hash_in = nullptr;
+    if (!hash_path.isEmpty() && !(hash_out = fopen(qPrintable(hash_path), "w"))) {
+        fprintf(stderr, "can't write %s\n", qPrintable(hash_path));
+        return 1;
+    }
+    if (!check_path.isEmpty() && !(hash_in = fopen(qPrintable(check_path), "r"))) {
+        fprintf(stderr, "can't read %s\n", qPrintable(check_path));
+        return 1;
+    }
+
+    // the consoles checked against this one, and what they return each frame
+    std::unique_ptr<VecEnv> envs;
+    ObservationFormat format = check_format();
+    std::vector<quint8> env_frames, env_observations, expected, raw, last_raw;
+    if (env_count) {
+        envs.reset(new VecEnv(env_count, env_count)); // a thread each, even on one core
+        if (!envs->load(rom, &error)) {
+            fprintf(stderr, "can't load %s: %s\n", qPrintable(rom), qPrintable(error));
+            return 1;
+        }
+        envs->set_observation(format);
+        env_frames.resize(size_t(env_count) * VecEnv::frame_size);
+        env_observations.resize(size_t(env_count) * envs->observation_size());
+        expected.assign(envs->observation_size(), 0);
+        raw.resize(envs->observation_size() / format.stack);
+        last_raw.assign(raw.size(), 0);
+    }
+
+    timer.start();
+    for (int f = start; f < frames; f++) {
+        quint8 buttons[VecEnv::ports] = {0, 0};
+        if (random_input) {
+            seed = seed * 1664525u + 1013904223u;
+            buttons[0] = quint8(seed >> 24);
+            buttons[1] = quint8(seed >> 16);
+            nes.controller_left.set_buttons(buttons[0]);
+            nes.controller_right.set_buttons(buttons[1]);
+        }
+        nes.run_frame();
+        movie.frame_done();
+
+        if (envs) {
+            std::vector<quint8> all_buttons;
+            for (int env = 0; env < env_count; env++)
+                all_buttons.insert(all_buttons.end(), buttons, buttons + VecEnv::ports);
+            bool drawn = f % 2 == 0;
+            envs->step(all_buttons.data(), drawn ? env_frames.data() : nullptr, nullptr,
+                       env_observations.data());
+
+            // stacked oldest first: last frame's observation, then this one's
+            int size = int(raw.size());
+            gray_cells(nes.Ppu, format, raw.data());
+            memmove(expected.data(), expected.data() + size, size);
+            for (int i = 0; i < size; i++)
+                expected[size + i] = qMax(raw[i], last_raw[i]);
+            last_raw = raw;
+
+            quint64 frame_hash = nes.state_hash();
+            for (int env = 0; env < env_count; env++) {
+                const char *what = nullptr;
+                if (envs->console(env).state_hash() != frame_hash)
+                    what = "state";
+                else if (drawn && memcmp(&env_frames[size_t(env) * VecEnv::frame_size], nes.Ppu.frame_data,
+                                         VecEnv::frame_size))
+                    what = "picture";
+                else if (memcmp(&env_observations[size_t(env) * expected.size()], expected.data(),
+                                expected.size()))
+                    what = "observation";
+                if (what) {
+                    printf("env %d differs at frame %u: %s\n", env, nes.frame_number(), what);
+                    return 3;
+                }
+            }
+        }
+
+        if (hash_out || hash_in) {
+            quint64 frame_hash = nes.state_hash();
+            if (hash_out)
+                fprintf(hash_out, "%u %016llx\n", nes.frame_number(), (unsigned long long) frame_hash);
+            if (hash_in) {
+                unsigned expected_frame;
+                unsigned long long expected;
+                if (fscanf(hash_in, "%u %llx", &expected_frame, &expected) != 2) {
+                    fprintf(stderr, "%s ends before frame %u\n", qPrintable(check_path),
+                            nes.frame_number());
+                    return 3;
+                }
+                if (expected_frame != nes.frame_number() || expected != frame_hash) {
+                    printf("first difference at frame %u: %016llx, expected %016llx at frame %u\n",
+                           nes.frame_number(), (unsigned long long) frame_hash, expected,
+                           expected_frame);
+                    return 3;
+                }
+            }
+        }
+    }
+    double seconds = timer.nsecsElapsed() / 1e9;
+    if (hash_out)
+        fclose(hash_out);
+    if (hash_in) {
+        fclose(hash_in);
+        printf("all frames match %s\n", qPrintable(check_path));
+    }
+    if (envs)
+        printf("%d envs on %d threads match every frame\n", env_count, envs->thread_count());
+    frames -= start;
+
+    if (use_index && !movie.save_index(play_path + ".idx")) {
+        fprintf(stderr, "can't write %s.idx\n", qPrintable(play_path));
+        return 1;
+    }
+
+    if (!record_path.isEmpty()) {
+        movie.stop();
+        if (!movie.save(record_path)) {
+            fprintf(stderr, "can't write %s\n", qPrintable(record_path));
+            return 1;
+        }
+    }
+
+    quint64 picture = hash_state((const char *) nes.Ppu.frame_data, sizeof(nes.Ppu.frame_data));
+    printf("frames %d  hash %016llx  picture %016llx  %.3f s  %.1f fps\n", frames,
+           (unsigned long long) nes.state_hash(), (unsigned long long) picture, seconds,
+           seconds > 0 ? frames / seconds : 0.0);
+    if (nes.Cpu.clock_count)
+        printf("idle %.1f%% of CPU cycles\n", 100.0 * nes.Cpu.idle_cycles / nes.Cpu.clock_count);
+    if (nes.Cpu.jammed)
+        printf("CPU jammed on opcode %02x at %04x\n", nes.Cpu.opcode, nes.Cpu.reg_pc);
+
+    if (runs > 1) {
+        // the first run, then the rest timed without the checks around it
+        std::vector<double> fps(1, seconds > 0 ? frames / seconds : 0.0);
+        quint64 first_hash = nes.state_hash();
+        for (int run = 1; run < runs; run++) {
+            if (!play_path.isEmpty())
+                movie.play(nes);
+            else
+                nes.power_on();
+            seed = first_seed;
+            timer.start();
+            for (int f = 0; f < frames; f++) {
+                if (random_input) {
+                    seed = seed * 1664525u + 1013904223u;
+                    nes.controller_left.set_buttons(quint8(seed >> 24));
+                    nes.controller_right.set_buttons(quint8(seed >> 16));
+                }
+                nes.run_frame();
+                movie.frame_done();
+            }
+            seconds = timer.nsecsElapsed() / 1e9;
+            fps.push_back(seconds > 0 ? frames / seconds : 0.0);
+            if (nes.state_hash() != first_hash) {
+                printf("run %d ends in another state\n", run + 1);
+                return 3;
+            }
+        }
+        for (int run = 0; run < runs; run++)
+            printf("run %d  %.1f fps\n", run + 1, fps[run]);
+        std::sort(fps.begin(), fps.end());
+        printf("runs %d  median %.1f fps  min %.1f  max %.1f\n", runs, fps[runs / 2], fps.front(),
+               fps.back());
+    }
+
+    if (!screenshot.isEmpty() && !write_ppm(screenshot, nes.Ppu)) {
+        fprintf(stderr, "can't write %s\n", qPrintable(screenshot));
+        return 1;
+    }
+    return 0;
+}
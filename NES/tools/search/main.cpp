@@ -0,0 +1,463 @@
+// Input search
+//
+// usage: search ROM [--state FILE.sav | --movie FILE.nesm] [--maximize EXPR] [--goal EXPR]
+//               [--beam N] [--hold FRAMES] [--segments N] [--actions LIST] [--jobs N]
+//               [--out FILE.nesm]
+//
+// Beam search over controller 1 input from a starting state: power-on, a
+// savestate, or the end of a movie. Each round every state in the beam tries
+// every action, held for --hold frames (8), on all cores (--jobs). The
+// children are ranked and the best --beam (32) distinct ones are kept; states
+// that hash the same are only kept once. After --segments rounds (60), or as
+// soon as a child meets the goal, the best run is replayed and written as a
+// movie starting from the same state.
+//
+// --maximize ranks by an expression over RAM; --goal stops at the first frame
+// where an expression is non-zero, so the movie is the fastest found to get
+// there. Expressions use $XXX for a byte of the 2 KB RAM, decimal or 0x
+// numbers, and C's * / % + - < <= > >= == != && || ! and parentheses:
+//   search smb.nes --maximize '$6D*256+$86'          (Mario's x position)
+//   search smb.nes --goal '$0E==3' --maximize '$86'
+//
+// --actions is a comma separated list of button sets held together, using
+// A B S(elect) T(start) U D L R, and - for none. The default suits
+// platformers: -,R,RA,RB,RAB,L,LA,A.
+
+#include "bus.h"
+#include "movie.h"
+#include "savestate.h"
+#include "snapshotpool.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Expression over RAM, compiled to a small stack program
+class Expression
+{
+public:
+    bool parse(const char *text)
+    {
+        start = p = text;
+        program.clear();
+        if (!parse_level(0))
+            return false;
+        skip_space();
+        if (*p)
+            return fail("unexpected text");
+
+        // nesting is limited, but every level can leave a value per
+        // precedence level waiting, so check what eval() will push
+        int top = 0, most = 0;
+        for (const Op &op : program) {
+            top += op.code == Const || op.code == Ram ? 1 : op.code == Neg || op.code == Not ? 0 : -1;
+            most = qMax(most, top);
+        }
+        if (most > stack_size)
+            return fail("expression too deep");
+        return true;
+    }
+
+    bool empty() const { return program.empty(); }
+
+    qint64 eval(const quint8 *ram) const
+    {
+        qint64 stack[stack_size];
+        int top = 0;
+        for (const Op &op : program) {
+            qint64 b = top > 0 ? stack[top - 1] : 0;
+            qint64 a = top > 1 ? stack[top - 2] : 0;
+            switch (op.code) {
+            case Const: stack[top++] = op.value; continue;
+            case Ram: stack[top++] = ram[op.value]; continue;
+            case Neg: stack[top - 1] = -b; continue;
+            case Not: stack[top - 1] = !b; continue;
+            case Mul: a = a * b; break;
+            case Div: a = b ? a / b : 0; break;
+            case Mod: a = b ? a % b : 0; break;
+            case Add: a = a + b; break;
+            case Sub: a = a - b; break;
+            case Lt: a = a < b; break;
+            case Le: a = a <= b; break;
+            case Gt: a = a > b; break;
+            case Ge: a = a >= b; break;
+            case Eq: a = a == b; break;
+            case Ne: a = a != b; break;
+            case And: a = a && b; break;
+            case Or: a = a || b; break;
+            }
+            stack[top-- - 2] = a;
+        }
+        return top ? stack[0] : 0;
+    }
+
+    QString error;
+
+private:
+    enum { stack_size = 64 };
+    enum Code { Const, Ram, Neg, Not, Mul, Div, Mod, Add, Sub, Lt, Le, Gt, Ge, Eq, Ne, And, Or };
+    struct Op
+    {
+        Code code;
+        qint64 value;
+    };
+    struct Binary
+    {
+        const char *text;
+        int level;
+        Code code;
+    };
+
+    std::vector<Op> program;
+    const char *start;
+    const char *p;
+    int depth = 0;
+
+    bool fail(const char *what)
+    {
+        error = QString("%1 at column %2").arg(what).arg(int(p - start) + 1);
+        return false;
+    }
+
+    void skip_space()
+    {
+        while (isspace(quint8(*p)))
+            p++;
+    }
+
+    // lowest precedence first, longer operators before their prefixes
+    bool parse_level(int level)
+    {
+        static const Binary binary[] = {{"||", 0, Or}, {"&&", 1, And}, {"==", 2, Eq}, {"!=", 2, Ne},
+                                        {"<=", 3, Le}, {">=", 3, Ge},  {"<", 3, Lt},  {">", 3, Gt},
+                                        {"+", 4, Add}, {"-", 4, Sub},  {"*", 5, Mul}, {"/", 5, Div},
+                                        {"%", 5, Mod}};
+        if (level > 5)
+            return parse_unary();
+        if (!parse_level(level + 1))
+            return false;
+        for (;;) {
+            skip_space();
+            const Binary *found = nullptr;
+            for (const Binary &op : binary) {
+                if (op.level == level && !strncmp(p, op.text, strlen(op.text))) {
+                    found = &op;
+                    break;
+                }
+            }
+            if (!found)
+                return true;
+            p += strlen(found->text);
+            if (!parse_level(level + 1))
+                return false;
+            program.push_back({found->code, 0});
+        }
+    }
+
+    bool parse_unary()
+    {
+        skip_space();
+        if (++depth > 32)
+            return fail("expression too deep");
+        bool ok = true;
+        if (*p == '-' || *p == '!') {
+            Code code = *p++ == '-' ? Neg : Not;
+            ok = parse_unary();
+            program.push_back({code, 0});
+        } else if (*p == '(') {
+            p++;
+            ok = parse_level(0);
+            skip_space();
+            if (ok && *p++ != ')')
+                ok = fail("missing )");
+        } else if (*p == '$') {
+            char *end;
+            long addr = strtol(++p, &end, 16);
+            if (end == p || addr < 0 || addr >= 0x800)
+                ok = fail("RAM address must be $0-$7FF");
+            p = end;
+            program.push_back({Ram, addr});
+        } else if (isdigit(quint8(*p))) {
+            char *end;
+            program.push_back({Const, strtoll(p, &end, 0)});
+            p = end;
+        } else {
+            ok = fail("expected a number, $address, - ! or (");
+        }
+        depth--;
+        return ok;
+    }
+};
+
+bool parse_actions(const char *text, std::vector<quint8> &actions)
+{
+    static const char keys[] = "ABSTUDLR"; // bit n = FC_KEY n
+    actions.clear();
+    quint8 buttons = 0;
+    bool any = false;
+    for (const char *c = text;; c++) {
+        if (*c == ',' || *c == '\0') {
+            if (!any)
+                return false;
+            actions.push_back(buttons);
+            buttons = 0;
+            any = false;
+            if (*c == '\0')
+                return true;
+        } else if (*c == '-') {
+            any = true;
+        } else {
+            const char *key = strchr(keys, toupper(*c));
+            if (!key || !*key)
+                return false;
+            buttons |= 1 << (key - keys);
+            any = true;
+        }
+    }
+}
+
+struct Node
+{
+    int slot;       // in the pool of its round
+    qint64 score;
+    int goal_frame; // frames from the start until the goal was met, -1 if not
+    quint64 hash;
+    int parent;
+    int action;
+};
+
+struct Path
+{
+    std::vector<quint8> inputs; // buttons on each frame since the start
+};
+
+int usage()
+{
+    fprintf(stderr, "usage: search ROM [--state FILE.sav | --movie FILE.nesm] [--maximize EXPR] [--goal EXPR]\n"
+                    "              [--beam N] [--hold FRAMES] [--segments N] [--actions LIST] [--jobs N]\n"
+                    "              [--out FILE.nesm]\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QString rom, state_path, movie_path, out_path = "search.nesm";
+    Expression maximize, goal;
+    int beam_width = 32, hold = 8, segments = 60;
+    int jobs = qMax(int(std::thread::hardware_concurrency()), 1);
+    std::vector<quint8> actions;
+    parse_actions("-,R,RA,RB,RAB,L,LA,A", actions);
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--state") && has_value)
+            state_path = argv[++i];
+        else if (!strcmp(argv[i], "--movie") && has_value)
+            movie_path = argv[++i];
+        else if ((!strcmp(argv[i], "--maximize") || !strcmp(argv[i], "--goal")) && has_value) {
+            Expression &e = argv[i][2] == 'm' ? maximize : goal;
+            if (!e.parse(argv[++i])) {
+                fprintf(stderr, "%s: %s\n", argv[i], qPrintable(e.error));
+                return 2;
+            }
+        } else if (!strcmp(argv[i], "--beam") && has_value)
+            beam_width = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--hold") && has_value)
+            hold = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--segments") && has_value)
+            segments = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--actions") && has_value) {
+            if (!parse_actions(argv[++i], actions)) {
+                fprintf(stderr, "bad action list %s\n", argv[i]);
+                return 2;
+            }
+        } else if (!strcmp(argv[i], "--jobs") && has_value)
+            jobs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--out") && has_value)
+            out_path = argv[++i];
+        else if (argv[i][0] != '-' && rom.isEmpty())
+            rom = argv[i];
+        else
+            return usage();
+    }
+    if (rom.isEmpty() || (maximize.empty() && goal.empty()) || beam_width < 1 || hold < 1
+        || segments < 1 || jobs < 1 || (!state_path.isEmpty() && !movie_path.isEmpty()))
+        return usage();
+
+    // the console the search starts from, and later replays the result
+    static Bus nes;
+    QString error;
+    std::shared_ptr<const RomImage> image = RomImage::read(rom, &error);
+    if (!image || !nes.cartridge.load_image(image, &error)) {
+        fprintf(stderr, "can't load %s: %s\n", qPrintable(rom), qPrintable(error));
+        return 1;
+    }
+    nes.reset();
+    nes.Apu.suppress_output(true);
+
+    QByteArray start_state;
+    if (!state_path.isEmpty()) {
+        QFile file(state_path);
+        if (!file.open(QIODevice::ReadOnly) || !nes.load_state(file.readAll())) {
+            fprintf(stderr, "can't load state %s\n", qPrintable(state_path));
+            return 1;
+        }
+    } else if (!movie_path.isEmpty()) {
+        Movie prefix;
+        if (!prefix.load(movie_path) || !prefix.play(nes)) {
+            fprintf(stderr, "can't play %s\n", qPrintable(movie_path));
+            return 1;
+        }
+        while (!prefix.finished())
+            nes.run_frame();
+        prefix.stop();
+    }
+    bool from_power_on = state_path.isEmpty() && movie_path.isEmpty();
+    if (!from_power_on)
+        nes.save_state(start_state);
+
+    // one console per thread, sharing the ROM
+    jobs = qMin(jobs, beam_width * int(actions.size()));
+    std::vector<std::unique_ptr<Bus>> consoles;
+    for (int t = 0; t < jobs; t++) {
+        consoles.emplace_back(new Bus);
+        consoles.back()->cartridge.load_image(image);
+        consoles.back()->Apu.suppress_output(true);
+    }
+
+    // the beam lives in one pool and its children go to the other
+    int children_per_round = beam_width * int(actions.size());
+    SnapshotPool pools[2] = {SnapshotPool(nes, children_per_round), SnapshotPool(nes, children_per_round)};
+    int current = 0;
+    pools[current].save(nes, 0);
+    std::vector<Node> beam{{0, 0, -1, 0, -1, 0}};
+    std::vector<Path> paths(1);
+
+    QElapsedTimer timer;
+    timer.start();
+    quint64 frames_run = 0;
+    bool goal_met = false;
+    int round = 0;
+    for (; round < segments && !goal_met; round++) {
+        int next_pool = 1 - current;
+        int count = int(beam.size() * actions.size());
+        std::vector<Node> children(count);
+        std::atomic<int> next(0);
+
+        auto work = [&](Bus &console) {
+            for (int c; (c = next++) < count;) {
+                Node &child = children[c];
+                child.parent = c / int(actions.size());
+                child.action = c % int(actions.size());
+                child.slot = c;
+                child.goal_frame = -1;
+                pools[current].restore(console, beam[child.parent].slot);
+                for (int f = 0; f < hold; f++) {
+                    console.controller_left.set_buttons(actions[child.action]);
+                    console.run_frame();
+                    if (child.goal_frame < 0 && !goal.empty() && goal.eval(console.ram_data))
+                        child.goal_frame = round * hold + f + 1;
+                }
+                child.score = maximize.empty() ? 0 : maximize.eval(console.ram_data);
+                pools[next_pool].save(console, c);
+                child.hash = hash_state(pools[next_pool].data(c), pools[next_pool].slot_size());
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 1; t < jobs; t++)
+            threads.emplace_back(work, std::ref(*consoles[t]));
+        work(*consoles[0]);
+        for (std::thread &t : threads)
+            t.join();
+        frames_run += quint64(count) * hold;
+
+        // goal first (soonest wins), then score; equal states are kept once.
+        // Ties go by hash, which mixes the parents; in order, the first
+        // parent's children would fill the beam whenever nothing scores.
+        std::vector<int> order(count);
+        for (int c = 0; c < count; c++)
+            order[c] = c;
+        std::sort(order.begin(), order.end(), [&](int a, int b) {
+            const Node &x = children[a], &y = children[b];
+            if ((x.goal_frame >= 0) != (y.goal_frame >= 0))
+                return x.goal_frame >= 0;
+            if (x.goal_frame != y.goal_frame)
+                return x.goal_frame < y.goal_frame;
+            if (x.score != y.score)
+                return x.score > y.score;
+            return x.hash < y.hash;
+        });
+
+        std::set<quint64> seen;
+        std::vector<Node> kept;
+        std::vector<Path> kept_paths;
+        for (int c : order) {
+            if (!seen.insert(children[c].hash).second || int(kept.size()) == beam_width)
+                continue;
+            const Node &child = children[c];
+            Path path = paths[child.parent];
+            path.inputs.insert(path.inputs.end(), size_t(hold), actions[child.action]);
+            kept.push_back(child);
+            kept_paths.push_back(path);
+        }
+        beam.swap(kept);
+        paths.swap(kept_paths);
+        current = next_pool;
+        goal_met = beam[0].goal_frame >= 0;
+
+        if ((round + 1) % 10 == 0 || goal_met || round + 1 == segments)
+            printf("round %d  frame %d  best %lld  distinct %d/%d  %.0f frames/s\n", round + 1,
+                   (round + 1) * hold, (long long) beam[0].score, int(seen.size()), count,
+                   frames_run / (timer.nsecsElapsed() / 1e9));
+    }
+
+    // replay the best path from the start while recording it
+    std::vector<quint8> &inputs = paths[0].inputs;
+    if (goal_met)
+        inputs.resize(size_t(beam[0].goal_frame));
+    Movie movie;
+    if (from_power_on) {
+        movie.record(nes, true);
+    } else {
+        nes.load_state(start_state);
+        movie.record(nes, false);
+    }
+    for (quint8 buttons : inputs) {
+        nes.controller_left.set_buttons(buttons);
+        nes.run_frame();
+    }
+    movie.stop();
+    if (!movie.save(out_path)) {
+        fprintf(stderr, "can't write %s\n", qPrintable(out_path));
+        return 1;
+    }
+
+    // the replay should end where the search did
+    if (goal_met)
+        printf("goal met after %d frames (replayed: %s)", beam[0].goal_frame,
+               goal.eval(nes.ram_data) ? "met" : "NOT met");
+    else
+        printf("goal not met, best after %d frames", int(inputs.size()));
+    if (!maximize.empty() && !goal_met)
+        printf(", score %lld (replayed: %lld)", (long long) beam[0].score,
+               (long long) maximize.eval(nes.ram_data));
+    printf("\nwrote %s, %.1f s\n", qPrintable(out_path), timer.nsecsElapsed() / 1e9);
+    return 0;
+}
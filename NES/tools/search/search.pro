@@ -0,0 +1,15 @@
+# Input search: beam search over button sequences from a starting state,
+# scored by an expression over RAM, written out as a movie.
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT -= gui
+
+QMAKE_CXXFLAGS_RELEASE += -O3
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp
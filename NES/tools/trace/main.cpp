@@ -0,0 +1,309 @@
+// CPU trace recorder
+//
+// usage: trace ROM [--nestest] [--instructions N] [--ring N] [--log FILE]
+//                  [--dump FILE] [--compare REFERENCE.log [--ppu]]
+//        trace --format DUMP [--log FILE]
+//
+// Runs ROM from reset with the CPU recording every instruction into a
+// TraceRing, then hands the records to the outputs in batches:
+//  --log       nestest.log style text
+//  --dump      the raw records, to be turned into text later with --format
+//  --compare   checks each instruction against a reference log (such as
+//              nestest.log) and stops at the first one that differs. PC,
+//              opcode bytes, A, X, Y, P, SP and the cycle count (relative to
+//              the first line) are compared; --ppu adds the PPU position.
+//
+// --nestest starts at 0xC000 for nestest's automatic mode and stops at its
+// end, or before an opcode the CPU doesn't implement.
+
+#include "bus.h"
+#include "trace.h"
+
+#include <QCoreApplication>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+const char dump_magic[4] = {'N', 'E', 'S', 'T'};
+const quint32 dump_version = 1;
+
+struct Reference
+{
+    FILE *file = nullptr;
+    int line = 0;
+    bool compare_ppu = false;
+    bool have_base = false;
+    qint64 cycle_base = 0; // reference cycle minus ours
+};
+
+// Fields of a nestest.log line; returns false if the line doesn't have them
+bool parse_reference(const char *line, TraceRecord &r, int &length)
+{
+    unsigned pc, a, x, y, p, sp;
+    unsigned long long cycle;
+    if (sscanf(line, "%4x", &pc) != 1 || strlen(line) < 16)
+        return false;
+    r.pc = quint16(pc);
+
+    // up to three bytes in the columns after the PC, then the disassembly
+    quint8 bytes[3] = {0, 0, 0};
+    length = 0;
+    for (; length < 3; length++) {
+        const char *b = line + 6 + length * 3;
+        if (!isxdigit(quint8(b[0])) || !isxdigit(quint8(b[1])) || b[2] != ' ')
+            break;
+        bytes[length] = quint8(strtoul(QByteArray(b, 2).constData(), nullptr, 16));
+    }
+    if (length == 0)
+        return false;
+    r.opcode = bytes[0];
+    r.operand[0] = bytes[1];
+    r.operand[1] = bytes[2];
+
+    const char *regs = strstr(line, "A:");
+    const char *cyc = strstr(line, "CYC:");
+    if (!regs || !cyc || sscanf(regs, "A:%x X:%x Y:%x P:%x SP:%x", &a, &x, &y, &p, &sp) != 5
+        || sscanf(cyc, "CYC:%llu", &cycle) != 1)
+        return false;
+    r.a = quint8(a);
+    r.x = quint8(x);
+    r.y = quint8(y);
+    r.p = quint8(p);
+    r.sp = quint8(sp);
+    r.cycle = cycle;
+
+    int scanline = 0, dot = 0;
+    const char *ppu = strstr(line, "PPU:");
+    if (ppu)
+        sscanf(ppu, "PPU:%d,%d", &scanline, &dot);
+    r.scanline = qint16(scanline);
+    r.dot = qint16(dot);
+    return true;
+}
+
+// Returns false at the first difference, after printing it
+bool compare(Reference &ref, const TraceRecord &r, const CPU &cpu)
+{
+    char line[256];
+    if (!fgets(line, sizeof(line), ref.file)) {
+        printf("reference ends after %d lines, all matched\n", ref.line);
+        return false;
+    }
+    ref.line++;
+
+    TraceRecord expected;
+    int length;
+    if (!parse_reference(line, expected, length)) {
+        printf("line %d of the reference can't be read:\n%s", ref.line, line);
+        return false;
+    }
+    if (!ref.have_base) {
+        ref.cycle_base = qint64(expected.cycle) - qint64(r.cycle);
+        ref.have_base = true;
+    }
+
+    QString fields;
+    if (expected.pc != r.pc)
+        fields += " PC";
+    if (expected.opcode != r.opcode || (length > 1 && expected.operand[0] != r.operand[0])
+        || (length > 2 && expected.operand[1] != r.operand[1]))
+        fields += " bytes";
+    if (expected.a != r.a)
+        fields += " A";
+    if (expected.x != r.x)
+        fields += " X";
+    if (expected.y != r.y)
+        fields += " Y";
+    if (expected.p != r.p)
+        fields += " P";
+    if (expected.sp != r.sp)
+        fields += " SP";
+    if (qint64(expected.cycle) != qint64(r.cycle) + ref.cycle_base)
+        fields += " CYC";
+    if (ref.compare_ppu && (expected.scanline != r.scanline || expected.dot != r.dot))
+        fields += " PPU";
+    if (fields.isEmpty())
+        return true;
+
+    TraceRecord shifted = r;
+    shifted.cycle = quint64(qint64(r.cycle) + ref.cycle_base);
+    printf("first difference at line %d:%s\n", ref.line, qPrintable(fields));
+    printf("expected: %s", line);
+    printf("got:      %s\n", qPrintable(cpu.trace_line(shifted)));
+    return false;
+}
+
+int format_dump(const char *path, FILE *log)
+{
+    FILE *in = fopen(path, "rb");
+    char header[12];
+    quint32 version, size;
+    if (!in || fread(header, 1, 12, in) != 12 || memcmp(header, dump_magic, 4) != 0) {
+        fprintf(stderr, "%s isn't a trace dump\n", path);
+        return 1;
+    }
+    memcpy(&version, header + 4, 4);
+    memcpy(&size, header + 8, 4);
+    if (version != dump_version || size != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s was written by another version\n", path);
+        return 1;
+    }
+
+    CPU cpu; // only for its instruction table
+    TraceRecord r;
+    while (fread(&r, sizeof(r), 1, in) == 1)
+        fprintf(log, "%s\n", qPrintable(cpu.trace_line(r)));
+    fclose(in);
+    return 0;
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: trace ROM [--nestest] [--instructions N] [--ring N] [--log FILE]\n"
+                    "                 [--dump FILE] [--compare REFERENCE.log [--ppu]]\n"
+                    "       trace --format DUMP [--log FILE]\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    const char *rom = nullptr, *log_path = nullptr, *dump_path = nullptr;
+    const char *compare_path = nullptr, *format_path = nullptr;
+    bool nestest = false, compare_ppu = false;
+    quint64 instructions = 0;
+    int ring_size = 1 << 16;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--nestest"))
+            nestest = true;
+        else if (!strcmp(argv[i], "--instructions") && has_value)
+            instructions = strtoull(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--ring") && has_value)
+            ring_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--log") && has_value)
+            log_path = argv[++i];
+        else if (!strcmp(argv[i], "--dump") && has_value)
+            dump_path = argv[++i];
+        else if (!strcmp(argv[i], "--compare") && has_value)
+            compare_path = argv[++i];
+        else if (!strcmp(argv[i], "--ppu"))
+            compare_ppu = true;
+        else if (!strcmp(argv[i], "--format") && has_value)
+            format_path = argv[++i];
+        else if (argv[i][0] != '-' && !rom)
+            rom = argv[i];
+        else
+            return usage();
+    }
+
+    FILE *log = log_path ? fopen(log_path, "w") : nullptr;
+    if (log_path && !log) {
+        fprintf(stderr, "can't write %s\n", log_path);
+        return 1;
+    }
+    if (format_path)
+        return format_dump(format_path, log ? log : stdout);
+    if (!rom || ring_size < 2)
+        return usage();
+    if (!instructions)
+        instructions = nestest || compare_path ? ~0ull : 100000;
+
+    FILE *dump = dump_path ? fopen(dump_path, "wb") : nullptr;
+    if (dump_path && !dump) {
+        fprintf(stderr, "can't write %s\n", dump_path);
+        return 1;
+    }
+    if (dump) {
+        quint32 record_size = sizeof(TraceRecord);
+        fwrite(dump_magic, 1, 4, dump);
+        fwrite(&dump_version, 4, 1, dump);
+        fwrite(&record_size, 4, 1, dump);
+    }
+    Reference ref;
+    ref.compare_ppu = compare_ppu;
+    if (compare_path && !(ref.file = fopen(compare_path, "r"))) {
+        fprintf(stderr, "can't read %s\n", compare_path);
+        return 1;
+    }
+
+    static Bus nes;
+    QString error;
+    if (!nes.cartridge.read_from_file(rom, &error)) {
+        fprintf(stderr, "can't load %s: %s\n", rom, qPrintable(error));
+        return 1;
+    }
+    nes.reset();
+    nes.Apu.suppress_output(true);
+    if (nestest) {
+        nes.Cpu.reg_pc = 0xC000;
+        nes.Cpu.cycles_wait = 0;
+    }
+
+    TraceRing ring(ring_size);
+    nes.Cpu.trace = &ring;
+    quint64 done = 0; // records handed to the outputs
+    bool stop = false;
+    QString reason = "instruction limit";
+
+    auto flush = [&] {
+        quint64 oldest = ring.total() - ring.size();
+        if (done < oldest) {
+            fprintf(stderr, "ring overflowed, %llu records lost\n", (unsigned long long) (oldest - done));
+            done = oldest;
+        }
+        for (; done < ring.total() && !stop; done++) {
+            const TraceRecord &r = ring.at(int(done - oldest));
+            if (log)
+                fprintf(log, "%s\n", qPrintable(nes.Cpu.trace_line(r)));
+            if (dump)
+                fwrite(&r, sizeof(r), 1, dump);
+            if (ref.file && !compare(ref, r, nes.Cpu)) {
+                stop = true;
+                reason = "comparison stopped";
+            }
+        }
+    };
+
+    while (!stop && ring.total() < instructions) {
+        if (nes.Cpu.cycles_wait == 0 && nestest) {
+            if (nes.Cpu.reg_pc == 0xC66E) {
+                reason = "end of nestest";
+                nes.clock(); // record the final RTS too
+                break;
+            }
+            if (!nes.Cpu.is_documented(nes.peek(nes.Cpu.reg_pc))) {
+                reason = QString("stopped before unsupported opcode %1 at %2")
+                             .arg(nes.peek(nes.Cpu.reg_pc), 2, 16, QChar('0'))
+                             .arg(nes.Cpu.reg_pc, 4, 16, QChar('0'));
+                break;
+            }
+        }
+        nes.clock();
+        if (ring.total() - done >= quint64(ring.capacity() / 2))
+            flush();
+    }
+    flush();
+
+    char line[256];
+    if (ref.file && !stop && fgets(line, sizeof(line), ref.file))
+        printf("trace ends before line %d of the reference:\n%s", ref.line + 1, line);
+    printf("%llu instructions traced (%s)\n", (unsigned long long) ring.total(), qPrintable(reason));
+    if (nestest)
+        printf("nestest result: %02X %02X\n", nes.ram_data[0x02], nes.ram_data[0x03]);
+    if (log)
+        fclose(log);
+    if (dump)
+        fclose(dump);
+    if (ref.file)
+        fclose(ref.file);
+    return 0;
+}
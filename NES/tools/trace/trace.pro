@@ -0,0 +1,18 @@
+# CPU trace recorder: runs a ROM with the instruction trace compiled in,
+# writes nestest.log style logs and compares them with a reference log.
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT -= gui
+
+QMAKE_CXXFLAGS_RELEASE += -O3
+
+# compile the trace hook into the CPU
+DEFINES += NES_TRACE
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,260 @@
+// Lockstep trace diff
+//
+// usage: tracediff ROM [--frames N] [--play MOVIE | --random-input SEED]
+//                      [--context N] [--no-video] [--reload N]
+//
+// Runs two consoles on the same ROM and input, A as the reference and B with
+// the options below, one instruction at a time. After every instruction the
+// two trace records (PC, opcode bytes, registers, cycle, PPU position) and the
+// bus writes made since the last one are compared, and at the end of every
+// frame the state hashes. Nothing is kept beyond a small ring per console, so
+// runs of any length are fine. At the first difference the last instructions
+// and writes are printed.
+//
+// Options for B:
+//  --no-video  skip drawing, as run-ahead and seeking do
+//  --reload N  save and load the state every N frames
+
+#include "bus.h"
+#include "movie.h"
+#include "trace.h"
+
+#include <QCoreApplication>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+struct Options
+{
+    bool video = true;
+    int reload = 0;
+};
+
+struct Side
+{
+    const char *name;
+    Options options;
+    Bus nes;
+    Movie movie;
+    TraceRing ring;
+    WriteRing writes;
+    quint64 writes_seen = 0; // writes already compared
+    bool frame_ended = false;
+    quint64 frame_hash = 0;
+    QByteArray state;
+};
+
+bool random_input = false;
+unsigned seed = 0;
+
+void set_random_input(Bus &nes)
+{
+    // the same buttons on both sides for the same frame
+    unsigned r = (seed ^ nes.frame_number()) * 2654435761u;
+    r ^= r >> 15;
+    r *= 2246822519u;
+    for (int k = 0; k < 8; k++) {
+        nes.controller_left.cur_keystate[k] = (r >> (24 + k)) & 1;
+        nes.controller_right.cur_keystate[k] = (r >> (16 + k)) & 1;
+    }
+}
+
+void end_frame(Side &side)
+{
+    side.nes.end_frame();
+    side.movie.frame_done();
+    if (side.options.reload && side.nes.frame_number() % side.options.reload == 0) {
+        side.nes.save_state(side.state);
+        side.nes.load_state(side.state);
+    }
+    if (random_input)
+        set_random_input(side.nes);
+    side.frame_ended = true;
+    side.frame_hash = side.nes.state_hash();
+}
+
+// Runs until the CPU has fetched its next instruction, which the CPU runs in
+// the same clock, so its writes are in the ring too
+void step(Side &side)
+{
+    side.frame_ended = false;
+    quint64 before = side.ring.total();
+    while (side.ring.total() == before) {
+        side.nes.clock();
+        if (side.nes.Ppu.frame_complete)
+            end_frame(side);
+    }
+}
+
+QString record_fields(const TraceRecord &a, const TraceRecord &b)
+{
+    QString fields;
+    if (a.pc != b.pc)
+        fields += " PC";
+    if (a.opcode != b.opcode || a.operand[0] != b.operand[0] || a.operand[1] != b.operand[1])
+        fields += " bytes";
+    if (a.a != b.a)
+        fields += " A";
+    if (a.x != b.x)
+        fields += " X";
+    if (a.y != b.y)
+        fields += " Y";
+    if (a.p != b.p)
+        fields += " P";
+    if (a.sp != b.sp)
+        fields += " SP";
+    if (a.cycle != b.cycle)
+        fields += " CYC";
+    if (a.scanline != b.scanline || a.dot != b.dot)
+        fields += " PPU";
+    return fields;
+}
+
+bool same_writes(const Side &a, const Side &b)
+{
+    quint64 count = a.writes.total() - a.writes_seen;
+    if (count != b.writes.total() - b.writes_seen)
+        return false;
+    if (count > quint64(a.writes.size()) || count > quint64(b.writes.size()))
+        return false; // more than the rings hold, call it a difference
+    for (int i = 0; i < int(count); i++) {
+        const BusWrite &wa = a.writes.at(a.writes.size() - int(count) + i);
+        const BusWrite &wb = b.writes.at(b.writes.size() - int(count) + i);
+        if (wa.cycle != wb.cycle || wa.addr != wb.addr || wa.data != wb.data)
+            return false;
+    }
+    return true;
+}
+
+// The instruction ring[index] and the writes made until the next one
+void print_instruction(const Side &side, int index, const char *prefix)
+{
+    const TraceRecord &r = side.ring.at(index);
+    printf("%s%s\n", prefix, qPrintable(side.nes.Cpu.trace_line(r)));
+    quint64 end = index + 1 < side.ring.size() ? side.ring.at(index + 1).cycle : ~0ull;
+    for (int i = 0; i < side.writes.size(); i++) {
+        const BusWrite &w = side.writes.at(i);
+        if (w.cycle >= r.cycle && w.cycle < end)
+            printf("%s      write $%04X = $%02X  CYC:%llu\n", prefix, w.addr, w.data,
+                   (unsigned long long) w.cycle);
+    }
+}
+
+void report(const Side &a, const Side &b, quint64 instruction, const QString &what)
+{
+    printf("first difference at instruction %llu, frame %u:%s\n", (unsigned long long) instruction,
+           a.nes.frame_number(), qPrintable(what));
+    int last = a.ring.size() - 1;
+    if (last > 0)
+        printf("last %d instructions in step:\n", last);
+    for (int i = 0; i < last; i++)
+        print_instruction(a, i, "  ");
+    print_instruction(a, last, "A ");
+    print_instruction(b, b.ring.size() - 1, "B ");
+}
+
+int usage()
+{
+    fprintf(stderr, "usage: tracediff ROM [--frames N] [--play MOVIE | --random-input SEED]\n"
+                    "                     [--context N] [--no-video] [--reload N]\n");
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QString rom, play_path;
+    int frames = -1;
+    int context = 20;
+    Options options;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--frames") && has_value)
+            frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--play") && has_value)
+            play_path = argv[++i];
+        else if (!strcmp(argv[i], "--random-input") && has_value) {
+            random_input = true;
+            seed = unsigned(strtoul(argv[++i], nullptr, 0));
+        } else if (!strcmp(argv[i], "--context") && has_value)
+            context = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--no-video"))
+            options.video = false;
+        else if (!strcmp(argv[i], "--reload") && has_value)
+            options.reload = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && rom.isEmpty())
+            rom = argv[i];
+        else
+            return usage();
+    }
+    if (rom.isEmpty() || context < 1 || options.reload < 0 || (random_input && !play_path.isEmpty()))
+        return usage();
+
+    // the consoles are too big for the stack
+    static Side sides[2];
+    Side &a = sides[0];
+    Side &b = sides[1];
+    a.name = "A";
+    b.name = "B";
+    b.options = options;
+
+    for (Side &side : sides) {
+        QString error;
+        if (!side.nes.cartridge.read_from_file(rom, &error)) {
+            fprintf(stderr, "can't load %s: %s\n", qPrintable(rom), qPrintable(error));
+            return 1;
+        }
+        side.nes.Apu.suppress_output(true);
+        side.nes.Ppu.video_output = side.options.video;
+        side.ring = TraceRing(context + 1);
+        side.writes = WriteRing(4 * (context + 1));
+        side.nes.Cpu.trace = &side.ring;
+        side.nes.write_trace = &side.writes;
+
+        if (!play_path.isEmpty()) {
+            if (!side.movie.load(play_path) || !side.movie.play(side.nes)) {
+                fprintf(stderr, "can't play %s\n", qPrintable(play_path));
+                return 1;
+            }
+            if (frames < 0)
+                frames = side.movie.length();
+        } else {
+            side.nes.reset();
+        }
+        if (random_input)
+            set_random_input(side.nes);
+    }
+    if (frames < 0)
+        frames = 600;
+
+    quint64 instruction = 0;
+    while (a.nes.frame_number() < quint32(frames)) {
+        step(a);
+        step(b);
+        instruction++;
+
+        QString what = record_fields(a.ring.at(a.ring.size() - 1), b.ring.at(b.ring.size() - 1));
+        if (!same_writes(a, b))
+            what += " writes";
+        if (a.frame_ended != b.frame_ended)
+            what += QString(" frame ended only on %1").arg(a.frame_ended ? a.name : b.name);
+        else if (a.frame_ended && a.frame_hash != b.frame_hash)
+            what += " state hash";
+        if (!what.isEmpty()) {
+            report(a, b, instruction, what);
+            return 3;
+        }
+        a.writes_seen = a.writes.total();
+        b.writes_seen = b.writes.total();
+    }
+
+    printf("%llu instructions, %d frames in step\n", (unsigned long long) instruction, frames);
+    return 0;
+}
@@ -0,0 +1,19 @@
+# Lockstep trace diff: runs two consoles side by side, one of them with a
+# fast path or savestate round trips switched on, and stops at the first
+# instruction or bus write where they differ.
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+QT -= gui
+
+QMAKE_CXXFLAGS_RELEASE += -O3
+
+# compile the trace hooks into the CPU and the bus
+DEFINES += NES_TRACE
+
+include(../../core.pri)
+
+SOURCES += \
+    main.cpp
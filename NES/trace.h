@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QtGlobal>
+#include <vector>
+
+// One executed instruction, taken when the CPU fetches its opcode
+struct TraceRecord
+{
+    quint64 cycle;   // CPU cycles since reset
+    quint16 pc;
+    qint16 scanline; // PPU position
+    qint16 dot;
+    quint8 opcode;
+    quint8 operand[2]; // the bytes after the opcode, whether used or not
+    quint8 a, x, y, p, sp;
+};
+
+// A CPU write that reached the bus (not OAM DMA)
+struct BusWrite
+{
+    quint64 cycle; // CPU cycles since reset
+    quint16 addr;
+    quint8 data;
+};
+
+// Fixed-size ring of the last records. Recording is a store and an
+// increment. The hooks in the CPU and the bus only exist when the core is
+// built with NES_TRACE defined, so normal builds pay nothing for them.
+template <typename T>
+class Ring
+{
+public:
+    explicit Ring(int capacity = 1 << 16) : head(0)
+    {
+        int size = 1;
+        while (size < capacity)
+            size <<= 1;
+        records.resize(size);
+        mask = size - 1;
+    }
+
+    void record(const T &r) { records[head++ & mask] = r; }
+    void clear() { head = 0; }
+
+    int capacity() const { return int(records.size()); }
+    int size() const { return int(qMin<quint64>(head, records.size())); }
+    quint64 total() const { return head; } // recorded since the last clear, including overwritten ones
+    const T &at(int i) const { return records[(head - size() + i) & mask]; } // 0 is the oldest kept
+
+private:
+    std::vector<T> records;
+    quint64 head;
+    quint64 mask;
+};
+
+typedef Ring<TraceRecord> TraceRing; // instructions, filled by CPU::trace
+typedef Ring<BusWrite> WriteRing;    // writes, filled by Bus::write_trace
+
+#endif // TRACE_H
@@ -0,0 +1,147 @@
+#include "vecenv.h"
+#include "bus.h"
+#include <cstring>
+
+VecEnv::VecEnv(int count, int threads) : next(0), batch_jammed(0)
+{
+    for (int i = 0; i < count; i++) {
+        consoles.emplace_back(new Bus);
+        consoles.back()->Apu.suppress_output(true); // nobody listens
+    }
+
+    if (threads <= 0)
+        threads = qMax(int(std::thread::hardware_concurrency()), 1);
+    threads = qMin(threads, qMax(count, 1));
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&VecEnv::worker, this);
+}
+
+VecEnv::~VecEnv()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+bool VecEnv::load(const QString &rom, QString *error)
+{
+    std::shared_ptr<const RomImage> image = RomImage::read(rom, error);
+    if (!image)
+        return false;
+    for (auto &nes : consoles) {
+        if (!nes->cartridge.load_image(image, error))
+            return false;
+    }
+    reset();
+    return true;
+}
+
+void VecEnv::reset()
+{
+    for (auto &nes : consoles)
+        nes->power_on();
+    for (auto &observer : observers)
+        observer->clear();
+}
+
+void VecEnv::reset(int env)
+{
+    consoles[env]->power_on();
+    if (!observers.empty())
+        observers[env]->clear();
+}
+
+bool VecEnv::set_observation(const ObservationFormat &format)
+{
+    for (auto &nes : consoles)
+        nes->Ppu.observation = nullptr;
+    observers.clear();
+
+    Observation check;
+    if (!check.set_format(format))
+        return false;
+    for (auto &nes : consoles) {
+        observers.emplace_back(new Observation);
+        observers.back()->set_format(format);
+        nes->Ppu.observation = observers.back().get();
+    }
+    return true;
+}
+
+int VecEnv::step(const quint8 *buttons, quint8 *frames, quint8 *ram, quint8 *observations)
+{
+    batch_buttons = buttons;
+    batch_frames = frames;
+    batch_ram = ram;
+    batch_observations = observations;
+    next = 0;
+    batch_jammed = 0;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        generation++;
+        busy = int(workers.size());
+    }
+    wake.notify_all();
+
+    run_batch();
+
+    std::unique_lock<std::mutex> guard(lock);
+    done.wait(guard, [this] { return busy == 0; });
+    return batch_jammed;
+}
+
+bool VecEnv::jammed(int env) const
+{
+    return consoles[env]->Cpu.jammed;
+}
+
+void VecEnv::worker()
+{
+    quint64 seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [&] { return quit || generation != seen; });
+        if (quit)
+            return;
+        seen = generation;
+
+        guard.unlock();
+        run_batch();
+        guard.lock();
+
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+void VecEnv::run_batch()
+{
+    int env;
+    while ((env = next++) < size())
+        step_console(env);
+}
+
+void VecEnv::step_console(int env)
+{
+    Bus &nes = *consoles[env];
+    if (batch_buttons) {
+        nes.controller_left.set_buttons(batch_buttons[env * ports]);
+        nes.controller_right.set_buttons(batch_buttons[env * ports + 1]);
+    }
+    nes.Ppu.video_output = batch_frames != nullptr;
+    nes.run_frame();
+    if (nes.Cpu.jammed)
+        batch_jammed++;
+
+    if (batch_frames)
+        memcpy(batch_frames + size_t(env) * frame_size, nes.Ppu.frame_data, frame_size);
+    if (batch_ram)
+        memcpy(batch_ram + size_t(env) * ram_size, nes.ram_data, ram_size);
+    if (batch_observations && !observers.empty())
+        observers[env]->copy_stack(batch_observations + size_t(env) * observation_size());
+}
@@ -0,0 +1,84 @@
+#ifndef VECENV_H
+#define VECENV_H
+
+#include "observation.h"
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Bus;
+
+// N consoles stepped together, for training agents. step() runs every
+// console one frame on a pool of threads and copies the pictures and RAM
+// into arrays the caller owns. Consoles playing the same game share its ROM
+// image. Sound is off.
+class VecEnv
+{
+public:
+    enum { frame_size = 240 * 256 * 3, ram_size = 2048, ports = 2 };
+
+    // 'threads' 0 uses one per core, never more than there are consoles.
+    // The calling thread is one of them.
+    explicit VecEnv(int count, int threads = 0);
+    ~VecEnv();
+
+    int size() const { return int(consoles.size()); }
+    int thread_count() const { return int(workers.size()) + 1; }
+    Bus &console(int env) { return *consoles[env]; }
+
+    // Load the game into every console, reading the file once, and power on.
+    // Fails with the reason in *error, if given.
+    bool load(const QString &rom, QString *error = nullptr);
+    void reset();        // power on every console
+    void reset(int env); // power on one, when its episode ends; cartridge RAM and mapper
+                         // included, so no episode depends on the one before
+
+    // Have every console build observations in this format while it draws.
+    // Fails if the format is invalid; observation_size() is then 0.
+    bool set_observation(const ObservationFormat &format);
+    int observation_size() const { return observers.empty() ? 0 : observers[0]->stack_size(); }
+
+    // Run every console one frame.
+    //  buttons       ports bytes per console, bit n = FC_KEY n (as in movies)
+    //  frames        frame_size bytes per console, RGB row by row, or nullptr
+    //  ram           ram_size bytes per console (ram_data), or nullptr
+    //  observations  observation_size() bytes per console, the stacked
+    //                frames oldest first, or nullptr
+    // Without 'frames' the consoles skip drawing the RGB picture.
+    // Returns how many consoles are jammed: their CPU stopped on an opcode it
+    // can't run (see CPU::jammed) and they only draw until reset(env).
+    int step(const quint8 *buttons, quint8 *frames, quint8 *ram, quint8 *observations = nullptr);
+    bool jammed(int env) const;
+
+private:
+    std::vector<std::unique_ptr<Bus>> consoles;
+    std::vector<std::unique_ptr<Observation>> observers; // one per console, if set
+    std::vector<std::thread> workers;
+
+    // the batch being run; consoles are claimed one at a time through 'next',
+    // so a thread that finishes early takes over the rest
+    const quint8 *batch_buttons = nullptr;
+    quint8 *batch_frames = nullptr;
+    quint8 *batch_ram = nullptr;
+    quint8 *batch_observations = nullptr;
+    std::atomic<int> next;
+    std::atomic<int> batch_jammed;
+
+    std::mutex lock;
+    std::condition_variable wake; // a batch is ready, or quit
+    std::condition_variable done; // the last worker finished its part
+    quint64 generation = 0;
+    int busy = 0;
+    bool quit = false;
+
+    void worker();
+    void run_batch();
+    void step_console(int env);
+};
+
+#endif // VECENV_H